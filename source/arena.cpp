@@ -0,0 +1,73 @@
+/*
+ *
+ *    arena.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+
+#include "arena.h"
+
+
+// size of additional blocks (if Reserve() was too small)
+#define ARENA_BLOCK_SIZE 65536
+
+
+Arena::Arena() {
+    nused = 0;
+    nsize = 0;
+}
+
+
+Arena::~Arena() {
+    Clear();
+}
+
+
+// make sure the next nbytes fit into the current block
+void Arena::Reserve(size_t nbytes) {
+    if (nused + nbytes <= nsize)
+        return;
+    char *p = (char *)malloc(nbytes);
+    if (p == NULL)
+        throw bad_alloc();
+    vblocks.push_back(p);
+    nused = 0;
+    nsize = nbytes;
+}
+
+
+void* Arena::Alloc(size_t nbytes, size_t nalign) {
+    size_t n = (nused + nalign - 1) & ~(nalign - 1);
+    if (vblocks.empty() || (n + nbytes > nsize)) {
+        Reserve(max((size_t)ARENA_BLOCK_SIZE, nbytes + nalign));
+        n = 0;
+    }
+    nused = n + nbytes;
+    return vblocks.back() + n;
+}
+
+
+void Arena::Clear() {
+    for (auto p : vblocks)
+        free(p);
+    vblocks.clear();
+    nused = 0;
+    nsize = 0;
+}
@@ -0,0 +1,54 @@
+/*
+ *
+ *    arena.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ARENA_H_
+#define ARENA_H_
+
+
+#include <cstddef>
+#include <vector>
+
+
+using namespace std;
+
+
+// bump allocator, all memory is released at once (Clear() or destructor)
+//  if the total size is known, Reserve() it and there is only one block
+class Arena
+{
+    vector<char *> vblocks; // all allocated blocks
+    size_t nused;           // used bytes of the last block
+    size_t nsize;           // size of the last block
+
+public:
+    Arena();
+    ~Arena();
+
+    void Reserve(size_t nbytes);
+    void* Alloc(size_t nbytes, size_t nalign = alignof(max_align_t));
+    void Clear();
+
+    template<typename T> T* AllocArray(size_t n) {
+        return (T *)Alloc(n * sizeof(T), alignof(T));
+    }
+};
+
+
+#endif /* ARENA_H_ */
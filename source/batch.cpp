@@ -0,0 +1,133 @@
+/*
+ *
+ *    batch.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+#include "batch.h"
+#include "loader.h"
+#include "mcasm.h"
+
+
+int read_joblist(const string& sfile, vector<job_t>& vjobs, ostream& err) {
+    string sdata;
+
+    if (read_file(sfile, sdata) == -1) {
+        err << "ERROR: Unable to open '" << sfile << "'" << endl;
+        return -1;
+    }
+
+    istringstream iss(sdata);
+    string sline;
+    int nline = 0;
+    while (getline(iss, sline)) {
+        ++nline;
+        // comments
+        size_t p = sline.find('#');
+        if (p != string::npos)
+            sline.erase(p);
+
+        istringstream ls(sline);
+        job_t job;
+        if (!(ls >> job.ssource))
+            continue;
+        ls >> job.spattern >> job.sformat;
+        if (job.sformat.empty())
+            job.sformat = "logisim";
+        if ((job.sformat != "logisim") && (job.sformat != "bin")) {
+            err << sfile << ":" << nline << ": error: Unknown output format '" << job.sformat << "'!" << endl;
+            return -1;
+        }
+        // default target: [source without extension]_rom%d.hex (or .bin)
+        if (job.spattern.empty()) {
+            size_t e = job.ssource.find_last_of('.');
+            size_t d = job.ssource.find_last_of("/\\");
+            string sbase = ((e == string::npos) || ((d != string::npos) && (e < d))) ? job.ssource : job.ssource.substr(0, e);
+            job.spattern = sbase + ((job.sformat == "bin") ? "_rom%d.bin" : "_rom%d.hex");
+        }
+        job.nline = nline;
+        job.nstatus = 0;
+        vjobs.push_back(job);
+    }
+    return 1;
+}
+
+
+int run_batch(vector<job_t>& vjobs, const config_t& cfg, const batchopts_t& opts) {
+    LineCache cache;
+    atomic<size_t> nnext(0);
+    vector<thread> vthreads;
+    int npool = max(1, min(cfg.nthreads, (int)vjobs.size()));
+    int nfailed = 0;
+
+    // each worker takes the next job, a job parses with the rest of the threads
+    for (int t = 0; t < npool; ++t) {
+        vthreads.push_back(thread([&]() {
+            size_t n;
+            while ((n = nnext.fetch_add(1)) < vjobs.size()) {
+                job_t& job = vjobs[n];
+                ostringstream log;
+                Mcasm mcasm;
+                image_t image;
+
+                mcasm.Config() = cfg;
+                mcasm.Config().w = false;
+                mcasm.Config().p = false;
+                mcasm.Config().nthreads = max(1, cfg.nthreads / npool);
+                mcasm.SetOutput(&log, &log);
+                mcasm.SetCache(&cache);
+                mcasm.SetStats(opts.pstats);
+                mcasm.SetTrace(opts.ptrace);
+                mcasm.SelectChips(opts.vnchips);
+                for (auto& d : opts.vdefines)
+                    mcasm.Define(d.first, d.second);
+                mcasm.SetFormat(job.sformat);
+                job.nstatus = -1;
+                if ((mcasm.Compile(job.ssource, image) == 1) &&
+                        (mcasm.Write(image, job.spattern, job.sformat) == 1) &&
+                        (job.sdepfile.empty() || (mcasm.WriteDepfile(job.sdepfile) == 1)))
+                    job.nstatus = 1;
+                job.slog = log.str();
+            }
+        }));
+    }
+    for (auto& t : vthreads)
+        t.join();
+
+    // per job status and log (in order of the job list)
+    for (size_t n = 0; n < vjobs.size(); ++n) {
+        job_t& job = vjobs[n];
+        if (job.nstatus != 1)
+            ++nfailed;
+        if (!cfg.s || (job.nstatus != 1)) {
+            ostream& os = (job.nstatus == 1) ? cout : cerr;
+            os << "=== [" << (n + 1) << "/" << vjobs.size() << "] " << job.ssource << ": "
+               << ((job.nstatus == 1) ? "ok" : "FAILED") << endl;
+            os << job.slog;
+        }
+    }
+    if (!cfg.s) {
+        cout << "Batch done: " << (vjobs.size() - nfailed) << " ok, " << nfailed << " failed ("
+             << cache.size() << " different files, " << cache.Hits() << " taken from the line cache)" << endl;
+    }
+    return nfailed;
+}
@@ -0,0 +1,68 @@
+/*
+ *
+ *    batch.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BATCH_H_
+#define BATCH_H_
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "stats.h"
+#include "trace.h"
+
+
+using namespace std;
+
+
+// one project of a batch
+typedef struct job {
+    string ssource;     // top level source file
+    string spattern;    // output files (%d = chip)
+    string sformat;     // output format (logisim, bin)
+    string sdepfile;    // make dependencies (empty = none)
+    int nline;          // line in the job list
+    int nstatus;        // -1 error, 1 ok (after run_batch)
+    string slog;        // messages and errors of the job
+} job_t;
+
+
+// options for all jobs (from the command line)
+typedef struct batchopts {
+    vector<pair<string, long long> > vdefines;  // overridden definitions (-D)
+    vector<int> vnchips;    // chips to generate and write (empty = all)
+    Stats *pstats;          // times and counters of all jobs (or NULL)
+    Trace *ptrace;          // spans of all jobs (or NULL)
+} batchopts_t;
+
+
+// job list: one job per line "source [target] [format]", '#' starts a comment
+//  returns -1 on error (printed to err)
+int read_joblist(const string& sfile, vector<job_t>& vjobs, ostream& err);
+
+// run all jobs on a thread pool, files used by several jobs are cleaned up only once
+//  (each job still reads and parses all of its files)
+//  returns the number of failed jobs
+int run_batch(vector<job_t>& vjobs, const config_t& cfg, const batchopts_t& opts);
+
+
+#endif /* BATCH_H_ */
@@ -0,0 +1,254 @@
+/*
+ *
+ *    cube.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+#include <unordered_map>
+
+#include "cube.h"
+
+
+// up to this number of values the cover is computed from the single values
+#define CUBE_EXACT_MAX 1024
+// stop merging if there are more implicants (only used for huge sets)
+#define CUBE_MAX_IMPLICANTS 65536
+// cubes_minimize(): grow and pick cubes only up to this number of cubes x cubes outside
+#define CUBE_MAX_GROW_TESTS 100000000LL
+
+
+static long long cube_key(const cube_t& c) {
+    return ((long long)(unsigned)c.nmask << 32) | (unsigned)c.nval;
+}
+
+
+// c is completely part of p
+static bool cube_covers(const cube_t& p, const cube_t& c) {
+    return ((c.nmask & p.nmask) == p.nmask) && ((c.nval & p.nmask) == p.nval);
+}
+
+
+// prime implicants (Quine-McCluskey): merge cubes that differ in one used bit
+//  until nothing can be merged anymore
+static void cubes_primes(vector<cube_t> vcur, vector<cube_t>& vprimes) {
+    while (!vcur.empty()) {
+        unordered_map<long long, size_t> mindex;
+        unordered_map<long long, size_t> mnext;
+        vector<char> vmerged(vcur.size(), 0);
+        vector<cube_t> vnext;
+
+        for (size_t i = 0; i < vcur.size(); ++i)
+            mindex[cube_key(vcur[i])] = i;
+        if (vcur.size() <= CUBE_MAX_IMPLICANTS) {
+            for (size_t i = 0; i < vcur.size(); ++i) {
+                for (int bits = vcur[i].nmask & ~vcur[i].nval; bits != 0; bits &= bits - 1) {
+                    int b = bits & -bits;
+                    cube_t other = { vcur[i].nval | b, vcur[i].nmask };
+                    auto it = mindex.find(cube_key(other));
+                    if (it == mindex.end())
+                        continue;
+                    vmerged[i] = 1;
+                    vmerged[it->second] = 1;
+                    cube_t merged = { vcur[i].nval, vcur[i].nmask & ~b };
+                    if (mnext.insert(make_pair(cube_key(merged), vnext.size())).second)
+                        vnext.push_back(merged);
+                }
+            }
+        }
+        for (size_t i = 0; i < vcur.size(); ++i) {
+            if (!vmerged[i])
+                vprimes.push_back(vcur[i]);
+        }
+        vcur.swap(vnext);
+    }
+}
+
+
+// as few of the primes as possible covering each of the cubes of vinit (each one by a
+//  single prime): essential primes first, then the one covering most of the rest
+static void cubes_cover(const vector<cube_t>& vinit, const vector<cube_t>& vprimes, vector<cube_t>& vcubes) {
+    vcubes.clear();
+    if (vinit.empty())
+        return;
+    vector<vector<size_t> > vcovers(vprimes.size());
+    vector<size_t> vncovering(vinit.size());
+    vector<size_t> vnlast(vinit.size());
+    vector<char> vdone(vinit.size(), 0);
+    vector<char> vused(vprimes.size(), 0);
+    size_t nleft = vinit.size();
+
+    for (size_t p = 0; p < vprimes.size(); ++p) {
+        for (size_t i = 0; i < vinit.size(); ++i) {
+            if (cube_covers(vprimes[p], vinit[i])) {
+                vcovers[p].push_back(i);
+                ++vncovering[i];
+                vnlast[i] = p;
+            }
+        }
+    }
+    auto use = [&](size_t p) {
+        vused[p] = 1;
+        for (size_t i : vcovers[p]) {
+            if (!vdone[i]) {
+                vdone[i] = 1;
+                --nleft;
+            }
+        }
+    };
+    for (size_t i = 0; i < vinit.size(); ++i) {
+        if ((vncovering[i] == 1) && !vdone[i])
+            use(vnlast[i]);
+    }
+    while (nleft > 0) {
+        size_t nbest = 0, nbest_count = 0;
+        for (size_t p = 0; p < vprimes.size(); ++p) {
+            size_t n = 0;
+            if (vused[p])
+                continue;
+            for (size_t i : vcovers[p])
+                n += !vdone[i];
+            if (n > nbest_count) {
+                nbest = p;
+                nbest_count = n;
+            }
+        }
+        use(nbest);
+    }
+
+    for (size_t p = 0; p < vprimes.size(); ++p) {
+        if (vused[p])
+            vcubes.push_back(vprimes[p]);
+    }
+    sort(vcubes.begin(), vcubes.end(), [](const cube_t& a, const cube_t& b) {
+        return a.nval < b.nval;
+    });
+}
+
+
+void cubes_from_ranges(const vector<range_t>& vranges, int nbits, vector<cube_t>& vcubes) {
+    int nfield = (nbits >= 31) ? 0x7FFFFFFF : ((1 << nbits) - 1);
+    vector<range_t> vsorted(vranges);
+    vector<range_t> vruns;
+    vector<cube_t> vinit;
+    vector<cube_t> vprimes;
+    long long ncount = 0;
+
+    // sort and join overlapping or adjacent ranges
+    sort(vsorted.begin(), vsorted.end(), [](const range_t& a, const range_t& b) {
+        return a.nfirst < b.nfirst;
+    });
+    for (auto& r : vsorted) {
+        if (!vruns.empty() && (r.nfirst <= vruns.back().nlast + 1))
+            vruns.back().nlast = max(vruns.back().nlast, r.nlast);
+        else
+            vruns.push_back(r);
+    }
+    for (auto& r : vruns)
+        ncount += r.nlast - r.nfirst + 1;
+
+    // what has to be covered: single values or aligned blocks
+    for (auto& r : vruns) {
+        for (long long n = r.nfirst; n <= r.nlast; ) {
+            long long nsize = 1;
+            if (ncount > CUBE_EXACT_MAX) {
+                while (((n & (nsize * 2 - 1)) == 0) && (n + nsize * 2 - 1 <= r.nlast))
+                    nsize *= 2;
+            }
+            cube_t c = { (int)n, nfield & ~(int)(nsize - 1) };
+            vinit.push_back(c);
+            n += nsize;
+        }
+    }
+
+    // cover: essential primes first, then the one covering most of the rest
+    cubes_primes(vinit, vprimes);
+    cubes_cover(vinit, vprimes, vcubes);
+}
+
+
+void cubes_minimize(const vector<cube_t>& vin, const vector<cube_t>& vout, int nbits, vector<cube_t>& vcubes) {
+    int nfield = (nbits >= 31) ? 0x7FFFFFFF : ((1 << nbits) - 1);
+    vector<cube_t> vprimes;
+
+    // too many for growing: only merge neighbours
+    if ((long long)vin.size() * (vout.size() + vin.size()) * nbits > CUBE_MAX_GROW_TESTS) {
+        vcubes.clear();
+        cubes_primes(vin, vcubes);
+        sort(vcubes.begin(), vcubes.end(), [](const cube_t& a, const cube_t& b) {
+            return a.nval < b.nval;
+        });
+        return;
+    }
+
+    // grow each cube (one bit after the other) as long as it touches nothing of vout
+    unordered_map<long long, size_t> mindex;
+    for (auto& c : vin) {
+        cube_t p = c;
+        for (int bits = p.nmask & nfield; bits != 0; bits &= bits - 1) {
+            int bit = bits & -bits;
+            cube_t other = { p.nval ^ bit, p.nmask }, tmp;
+            bool bfree = true;
+            for (auto& o : vout) {
+                if (cube_intersect(other, o, tmp)) {
+                    bfree = false;
+                    break;
+                }
+            }
+            if (bfree) {
+                p.nval &= ~bit;
+                p.nmask &= ~bit;
+            }
+        }
+        if (mindex.insert(make_pair(cube_key(p), vprimes.size())).second)
+            vprimes.push_back(p);
+    }
+    cubes_cover(vin, vprimes, vcubes);
+}
+
+
+void cubes_product(vector<cube_t>& vcubes, const vector<cube_t>& vother) {
+    vector<cube_t> vres;
+
+    vres.reserve(vcubes.size() * vother.size());
+    for (auto& a : vcubes) {
+        for (auto& b : vother) {
+            cube_t c = { a.nval | b.nval, a.nmask | b.nmask };
+            vres.push_back(c);
+        }
+    }
+    vcubes.swap(vres);
+}
+
+
+void cube_subtract(const cube_t& a, const cube_t& b, vector<cube_t>& vres) {
+    cube_t c;
+
+    if (!cube_intersect(a, b, c)) {
+        vres.push_back(a);
+        return;
+    }
+    // for each bit b cares about and a doesn't: the half of the rest that differs from b
+    cube_t rest = a;
+    for (int bits = b.nmask & ~a.nmask; bits != 0; bits &= bits - 1) {
+        int bit = bits & -bits;
+        cube_t piece = { (rest.nval & ~bit) | (~b.nval & bit), rest.nmask | bit };
+        vres.push_back(piece);
+        rest.nval = (rest.nval & ~bit) | (b.nval & bit);
+        rest.nmask |= bit;
+    }
+}
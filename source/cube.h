@@ -0,0 +1,74 @@
+/*
+ *
+ *    cube.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CUBE_H_
+#define CUBE_H_
+
+
+#include <vector>
+
+
+using namespace std;
+
+
+// set of input values: x matches if (x & nmask) == nval
+typedef struct cube {
+    int nval;           // value of the used bits
+    int nmask;          // used bits
+} cube_t;
+
+
+// range of values (inclusive)
+typedef struct range {
+    long long nfirst;
+    long long nlast;
+} range_t;
+
+
+inline bool cube_match(const cube_t& c, int x) {
+    return (x & c.nmask) == c.nval;
+}
+
+
+// addresses in both cubes, false if there are none
+inline bool cube_intersect(const cube_t& a, const cube_t& b, cube_t& res) {
+    if ((a.nval ^ b.nval) & a.nmask & b.nmask)
+        return false;
+    res.nval = a.nval | b.nval;
+    res.nmask = a.nmask | b.nmask;
+    return true;
+}
+
+// addresses of a that are not in b, as disjoint cubes (appended to vres)
+void cube_subtract(const cube_t& a, const cube_t& b, vector<cube_t>& vres);
+
+// cubes matching exactly the values of the ranges (within nbits)
+//  minimal for small sets, for large ones aligned blocks are merged as far as possible
+void cubes_from_ranges(const vector<range_t>& vranges, int nbits, vector<cube_t>& vcubes);
+
+// few cubes covering the cubes of vin, which must not touch any cube of vout
+//  (each one grown as far as vout allows, then as few as possible of them picked)
+void cubes_minimize(const vector<cube_t>& vin, const vector<cube_t>& vout, int nbits, vector<cube_t>& vcubes);
+
+// all combinations of the cubes of two independent inputs (masks don't overlap)
+void cubes_product(vector<cube_t>& vcubes, const vector<cube_t>& vother);
+
+
+#endif /* CUBE_H_ */
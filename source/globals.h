@@ -22,6 +22,8 @@
 #define GLOBALS_H_
 
 
+#include <functional>
+#include <iostream>
 #include <string>
 #include <vector>
 
@@ -36,6 +38,13 @@ using namespace std;
  */
 
 
+// subsystems writing messages (each one has its own log level)
+enum { LOG_LOADER, LOG_PARSER, LOG_GENERATOR, LOG_SUBSYSTEMS };
+
+// log levels, a message is written if its level is not above the one of the subsystem
+enum { LOG_ERROR, LOG_INFO, LOG_DEBUG, LOG_TRACE };
+
+
 // holds the configuration (changeable with cmdline options)
 typedef struct config {
     bool d; // debug
@@ -46,12 +55,13 @@ typedef struct config {
         bool g;   // debug Generator
     } d_flags;
     bool s; // silent
+    int nloglevels[LOG_SUBSYSTEMS]; // log level of each subsystem (-1 = from d, d_flags and s)
+    bool w; // watch mode
+    bool p; // progress of long runs (on perr, not if silent)
+    string sdepfile; // write make dependencies to this file (empty = off)
+    int nthreads; // max. number of threads
+    long long nmaxbytes; // refuse to generate bigger images or files (estimate, 0 = no limit)
 } config_t;
-extern config_t g_cfg;
-
-
-// holds all loaded file names
-extern vector<string> g_vfiles;
 
 
 // holds all loaded code lines
@@ -60,7 +70,31 @@ typedef struct mcLines {
     string sline;
     int    nline;
 } mcLines;
-extern vector<mcLines> g_vlines;
+
+
+// reads a (source) file into sdata, returns -1 if not possible
+typedef function<int(const string& sname, string& sdata)> readfile_t;
+
+
+class LineCache;
+class Stats;
+class Trace;
+class Log;
+
+
+// everything about one run, there are no globals so several can run at once
+typedef struct context {
+    config_t cfg;           // configuration
+    vector<string> vfiles;  // holds all loaded file names
+    vector<mcLines> vlines; // holds all loaded code lines
+    readfile_t readfile;    // how to get the content of a file (empty = from disk)
+    LineCache *pcache;      // cleaned lines shared with other runs (NULL = none)
+    Stats *pstats;          // times and counters (NULL = not collected)
+    Trace *ptrace;          // spans for chrome://tracing (NULL = off)
+    Log *plog;              // buffered messages (written to pout and perr)
+    ostream *pout;          // messages
+    ostream *perr;          // errors
+} context_t;
 
 
 #endif /* GLOBALS_H_ */
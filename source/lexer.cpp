@@ -0,0 +1,177 @@
+/*
+ *
+ *    lexer.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstring>
+#include <climits>
+
+#include "lexer.h"
+
+
+static inline bool is_alpha(char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'));
+}
+
+
+static inline bool is_digit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+
+static inline bool is_identchar(char c) {
+    return is_alpha(c) || is_digit(c) || (c == '_');
+}
+
+
+// value of a digit in base 2..16, -1 if not a digit of that base
+static inline int digit_value(char c, int base) {
+    int v;
+    if (is_digit(c))
+        v = c - '0';
+    else if ((c >= 'a') && (c <= 'f'))
+        v = c - 'a' + 10;
+    else if ((c >= 'A') && (c <= 'F'))
+        v = c - 'A' + 10;
+    else
+        return -1;
+    return (v < base) ? v : -1;
+}
+
+
+bool tok_equals(const token_t& tok, const char *s) {
+    return (strlen(s) == tok.len) && (memcmp(tok.p, s, tok.len) == 0);
+}
+
+
+Lexer::Lexer(const string& sline, size_t pos) {
+    sbuf = sline.data();
+    nlen = sline.size();
+    npos = pos;
+    _scan();
+}
+
+
+token_t Lexer::Next() {
+    token_t tok = tcur;
+    _scan();
+    return tok;
+}
+
+
+bool Lexer::Is(const char *punct) const {
+    return (tcur.type == TOK_PUNCT) && tok_equals(tcur, punct);
+}
+
+
+bool Lexer::Accept(const char *punct) {
+    if (!Is(punct))
+        return false;
+    _scan();
+    return true;
+}
+
+
+void Lexer::_scan() {
+    // skip spaces
+    while ((npos < nlen) && ((sbuf[npos] == ' ') || (sbuf[npos] == '\t')))
+        ++npos;
+
+    tcur.p = sbuf + npos;
+    tcur.pos = npos;
+    tcur.len = 0;
+    tcur.nval = 0;
+
+    // end of line
+    if (npos >= nlen) {
+        tcur.type = TOK_END;
+        return;
+    }
+
+    char c = sbuf[npos];
+    size_t s = npos;
+
+    // identifier
+    if (is_alpha(c)) {
+        while ((npos < nlen) && is_identchar(sbuf[npos]))
+            ++npos;
+        tcur.len = npos - s;
+        tcur.type = ((tcur.len == 1) && (c == 'x')) ? TOK_DONTCARE : TOK_IDENT;
+        return;
+    }
+
+    // number: the whole alphanumeric run belongs to it
+    if (is_digit(c)) {
+        int base = 10;
+        size_t d = s;
+        unsigned long long v = 0;
+
+        while ((npos < nlen) && is_identchar(sbuf[npos]))
+            ++npos;
+        tcur.len = npos - s;
+        tcur.type = TOK_NUMBER;
+        if ((c == '0') && (tcur.len > 1)) {
+            if ((sbuf[s+1] == 'x') || (sbuf[s+1] == 'X'))
+                base = 16;
+            else if ((sbuf[s+1] == 'b') || (sbuf[s+1] == 'B'))
+                base = 2;
+            if (base != 10) {
+                d += 2;
+                // no digits after prefix
+                if (d == npos) {
+                    tcur.type = TOK_ERROR;
+                    tcur.pos = d;
+                    return;
+                }
+            }
+        }
+        for (; d < npos; ++d) {
+            int dv = digit_value(sbuf[d], base);
+            // bad digit or overflow
+            if ((dv < 0) || (v > ((unsigned long long)LLONG_MAX - dv) / base)) {
+                tcur.type = TOK_ERROR;
+                tcur.pos = d;
+                return;
+            }
+            v = v * base + dv;
+        }
+        tcur.nval = (long long)v;
+        return;
+    }
+
+    // single chars
+    ++npos;
+    tcur.len = 1;
+    if (c == '!') {
+        tcur.type = TOK_NOT;
+        return;
+    }
+    if (c == '*') {
+        tcur.type = TOK_ALL;
+        return;
+    }
+    tcur.type = TOK_PUNCT;
+    // two char punctuation
+    if ((npos < nlen) && (
+            ((c == '.') && (sbuf[npos] == '.')) ||
+            ((c == '<') && (sbuf[npos] == '<')) ||
+            ((c == '>') && (sbuf[npos] == '>')))) {
+        ++npos;
+        tcur.len = 2;
+    }
+}
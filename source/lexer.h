@@ -0,0 +1,82 @@
+/*
+ *
+ *    lexer.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LEXER_H_
+#define LEXER_H_
+
+
+#include <string>
+
+
+using namespace std;
+
+
+// token types
+enum {
+    TOK_END = 0,    // end of line
+    TOK_IDENT,      // identifier (a..z, A..Z followed by a..z, A..Z, 0..9, _)
+    TOK_NUMBER,     // numeric value (decimal, hex(0x..) or binary(0b..))
+    TOK_PUNCT,      // punctuation: ( ) { } , = : .. << >> etc.
+    TOK_NOT,        // '!'
+    TOK_DONTCARE,   // 'x' (also a valid identifier)
+    TOK_ALL,        // '*'
+    TOK_ERROR       // malformed token, pos points to the offending char
+};
+
+
+typedef struct token {
+    int type;           // one of TOK_*
+    const char *p;      // first char (points into the line buffer)
+    size_t len;         // number of chars
+    size_t pos;         // column in the line
+    long long nval;     // value (TOK_NUMBER only)
+} token_t;
+
+
+// splits a (cleaned) line into tokens without copying anything
+//  the line must outlive the lexer and its tokens
+class Lexer
+{
+    const char *sbuf;   // line buffer
+    size_t nlen;        // length of the line
+    size_t npos;        // position of the next token
+    token_t tcur;       // current token (not consumed yet)
+
+    void _scan();
+
+public:
+    Lexer(const string& sline, size_t pos = 0);
+
+    // current token
+    const token_t& Peek() const { return tcur; }
+    // returns the current token and moves to the next one
+    token_t Next();
+    // is the current token the given punctuation?
+    bool Is(const char *punct) const;
+    // consumes the current token if it is the given punctuation
+    bool Accept(const char *punct);
+};
+
+
+// compares the token text
+bool tok_equals(const token_t& tok, const char *s);
+
+
+#endif /* LEXER_H_ */
@@ -20,22 +20,103 @@
  */
 #include <string>
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
-#include "Loader.h"
+#include "loader.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
 
 // some message macros
-#define debug(out)  if (g_cfg.d || g_cfg.d_flags.l) { cout << out << endl; }
-#define silent(out) if (!g_cfg.s || g_cfg.d || g_cfg.d_flags.l) { cout << out << endl; }
-#define error(out) { cerr << "ERROR: "<< out << endl; }
+#define debug(out)  log_msg(LOG_LOADER, LOG_DEBUG, out)
+#define silent(out) log_msg(LOG_LOADER, LOG_INFO, out)
+#define error(out)  log_msg(LOG_LOADER, LOG_ERROR, "ERROR: " << out)
+
+
+int read_file(const string& sname, string& sdata) {
+    ifstream ifs(sname, ios::in);
+    if (!ifs.is_open())
+        return -1;
+    ostringstream oss;
+    oss << ifs.rdbuf();
+    sdata = oss.str();
+    return 1;
+}
+
+
+// FNV-1a (64 bit)
+static unsigned long long hash_data(const string& sdata) {
+    unsigned long long h = 14695981039346656037ull;
+    for (auto c : sdata) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+
+LineCache::LineCache() {
+    nhits = 0;
+}
+
+
+// copy of the cached lines (with the new file_id), false if not cached
+bool LineCache::Find(const string& sdata, int file_id, vector<mcLines>& vlines) {
+    lock_guard<mutex> lock(cache_mutex);
+    auto range = mentries.equal_range(hash_data(sdata));
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.sdata != sdata)
+            continue;
+        vlines = it->second.vlines;
+        for (auto& l : vlines)
+            l.file_id = file_id;
+        ++nhits;
+        return true;
+    }
+    return false;
+}
+
+
+void LineCache::Store(const string& sdata, const vector<mcLines>& vlines) {
+    entry_t e = {sdata, vlines};
+    unsigned long long h = hash_data(sdata);
+    lock_guard<mutex> lock(cache_mutex);
+    auto range = mentries.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.sdata == sdata)
+            return;
+    }
+    mentries.insert(make_pair(h, e));
+}
+
+
+size_t LineCache::Hits() {
+    lock_guard<mutex> lock(cache_mutex);
+    return nhits;
+}
+
+
+size_t LineCache::size() {
+    lock_guard<mutex> lock(cache_mutex);
+    return mentries.size();
+}
+
+
+Loader::Loader(context_t& context) : ctx(context) {
+    file_id = 0;
+}
 
 
 int Loader::LoadFile(const char* filename) {
+    TraceSpan span(ctx.ptrace, "load", "LoadFile");
+    span.Arg("file", filename);
     silent("Loading file: '" << filename << "'...");
     
     // check if file is already loaded
-    for (int x = 0; x < (int)g_vfiles.size(); ++x) {
-        if (g_vfiles[x].compare(filename) == 0) {
+    for (int x = 0; x < (int)ctx.vfiles.size(); ++x) {
+        if (ctx.vfiles[x].compare(filename) == 0) {
             debug("File already loaded: " << filename);
             return 0;
         }
@@ -44,17 +125,41 @@ int Loader::LoadFile(const char* filename) {
     // add file to list
     string s;
     s.append(filename);
-    g_vfiles.push_back(s);
-    file_id = g_vfiles.size() - 1;
-
-    // load file
-    if (LoadLines() == -1)
-        return -1;
-    
-    // cleanup
-    if (Cleanup() == -1)
+    ctx.vfiles.push_back(s);
+    file_id = ctx.vfiles.size() - 1;
+
+    // read file (from disk or wherever the callback gets it)
+    string sdata;
+    int ret;
+    {
+        StatsTimer t(ctx.pstats, "load/read");
+        ret = ctx.readfile ? ctx.readfile(filename, sdata) : read_file(filename, sdata);
+    }
+    if (ret == -1) {
+        error("Unable to open '" << filename << "'")
         return -1;
-    debug("Loading file: '" << filename << "' done (" << v_mclines.size() << " lines)");
+    }
+    if (ctx.pstats) {
+        ctx.pstats->Add("files", 1);
+        ctx.pstats->Add("bytes read", sdata.size());
+    }
+
+    // same content already loaded and cleaned (by another run)
+    if (ctx.pcache && ctx.pcache->Find(sdata, file_id, v_mclines)) {
+        debug("Loading file: '" << filename << "' done (" << v_mclines.size() << " lines, cached)");
+    }
+    else {
+        // load file
+        if (LoadLines(sdata) == -1)
+            return -1;
+
+        // cleanup
+        if (Cleanup() == -1)
+            return -1;
+        debug("Loading file: '" << filename << "' done (" << v_mclines.size() << " lines)");
+        if (ctx.pcache)
+            ctx.pcache->Store(sdata, v_mclines);
+    }
 
 
     // process includes
@@ -65,31 +170,26 @@ int Loader::LoadFile(const char* filename) {
 }
 
 
-int Loader::LoadLines() {
-    // open file
-    file_ifs.open(g_vfiles.at(file_id), ios::in);
-    if (!file_ifs.is_open()) {
-        error("Unable to open '" << g_vfiles[file_id] << "'")
-        return -1;
-    }
-
+// split the content into lines
+int Loader::LoadLines(const string& sdata) {
+    StatsTimer t(ctx.pstats, "load/lines");
+    istringstream iss(sdata);
     mcLines l;
     l.file_id = file_id;
     l.nline = 0;
-    while (file_ifs.good()) {
+    while (iss.good()) {
         // load line
-        getline(file_ifs, l.sline);
+        getline(iss, l.sline);
         l.nline++;
         // convert to upper case
 // TODO: find better place for toupper()
 //        for_each(l.sline.begin(), l.sline.end(), [](char& in){ in = ::toupper(in); });
         // add line to buffer
         v_mclines.push_back(l);
-        debug(g_vfiles[file_id] << "[" << l.nline << "]: " << l.sline);
+        debug(ctx.vfiles[file_id] << "[" << l.nline << "]: " << l.sline);
     } // while
-
-    // close file
-    file_ifs.close();
+    if (ctx.pstats)
+        ctx.pstats->Add("lines read", l.nline);
 
     return 1;
 }
@@ -109,6 +209,9 @@ int Loader::Cleanup() {
  * @return int 
  */
 int Loader::CleanupPass1() {
+    StatsTimer t(ctx.pstats, "load/cleanup pass 1");
+    TraceSpan span(ctx.ptrace, "load", "CleanupPass1");
+    span.Arg("file", ctx.vfiles[file_id]);
     for (unsigned n = 0; n < v_mclines.size(); n++) {
         string sl = v_mclines.at(n).sline;
 
@@ -130,6 +233,9 @@ int Loader::CleanupPass1() {
  * @return int 
  */
 int Loader::CleanupPass2() {
+    StatsTimer t(ctx.pstats, "load/cleanup pass 2");
+    TraceSpan span(ctx.ptrace, "load", "CleanupPass2");
+    span.Arg("file", ctx.vfiles[file_id]);
     bool bcomment = false;
     for (unsigned n = 0; n < v_mclines.size(); n++) {
         string sl = v_mclines.at(n).sline;
@@ -181,6 +287,9 @@ int Loader::CleanupPass2() {
  * @return int 
  */
 int Loader::CleanupPass3() {
+    StatsTimer t(ctx.pstats, "load/cleanup pass 3");
+    TraceSpan span(ctx.ptrace, "load", "CleanupPass3");
+    span.Arg("file", ctx.vfiles[file_id]);
     for (unsigned n = 0; n < v_mclines.size(); n++) {
         string sl = v_mclines.at(n).sline;
 
@@ -234,11 +343,12 @@ int Loader::ProcessIncludes() {
             debug("#include: " << v_mclines.at(n).sline.substr(s, l));
 
             // load include-file
-            Loader nl;
+            Loader nl(ctx);
             if (nl.LoadFile(v_mclines.at(n).sline.substr(s, l).c_str()) == -1) {
                 return -1;
             }
             // remove #include
+            StatsTimer t(ctx.pstats, "load/includes");
             v_mclines.erase(v_mclines.begin()+n);
             // replace with loadet lines
             v_mclines.insert(v_mclines.begin()+n, nl.v_mclines.begin(), nl.v_mclines.end());
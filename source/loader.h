@@ -22,8 +22,10 @@
 #define LOADER_H_
 
 
-#include <fstream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "globals.h"
 
@@ -31,13 +33,39 @@
 using namespace std;
 
 
+// content of a file from disk, returns -1 if it can't be read
+int read_file(const string& sname, string& sdata);
+
+
+// cleaned lines of loaded files, shared by several runs (thread safe)
+//  the key is the content, so it doesn't matter where a file came from
+class LineCache
+{
+    typedef struct entry {
+        string sdata;           // content of the file
+        vector<mcLines> vlines; // after cleanup, before the includes
+    } entry_t;
+
+    mutex cache_mutex;
+    multimap<unsigned long long, entry_t> mentries; // by hash of the content
+    size_t nhits;
+
+public:
+    LineCache();
+
+    bool Find(const string& sdata, int file_id, vector<mcLines>& vlines);
+    void Store(const string& sdata, const vector<mcLines>& vlines);
+    size_t Hits();
+    size_t size();
+};
+
+
 class Loader
 {
-    int      file_id;   // id in g_vfiles
-    ifstream file_ifs;  // internal file stream
-    string   file_line; // current line buffer
+    context_t& ctx;
+    int      file_id;   // id in ctx.vfiles
 
-    int LoadLines();
+    int LoadLines(const string& sdata);
     int Cleanup();
     int CleanupPass1();
     int CleanupPass2();
@@ -45,6 +73,8 @@ class Loader
     int ProcessIncludes();
 
 public:
+    Loader(context_t& context);
+
     vector<mcLines> v_mclines;
 
     int LoadFile(const char* filename);
@@ -0,0 +1,94 @@
+/*
+ *
+ *    log.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+
+#include "log.h"
+
+
+Log::Log(const context_t& ctx) : ctx(ctx) {
+}
+
+
+Log::~Log() {
+    Flush();
+}
+
+
+// writes a buffer (buffers.Mutex() must be locked), the last message to perr if berror
+void Log::_write(buffer_t *pbuf, bool berror) {
+    string s = pbuf->os.str();
+    size_t nsplit = berror ? pbuf->nmark : s.size();
+
+    pbuf->os.str("");
+    pbuf->nmark = 0;
+    if (nsplit > 0) {
+        ctx.pout->write(s.data(), nsplit);
+        ctx.pout->flush();
+    }
+    if (nsplit < s.size()) {
+        ctx.perr->write(s.data() + nsplit, s.size() - nsplit);
+        ctx.perr->flush();
+    }
+}
+
+
+ostream& Log::Begin() {
+    buffer_t *pbuf = buffers.Get();
+    pbuf->nmark = pbuf->os.tellp();
+    return pbuf->os;
+}
+
+
+void Log::End(int nlevel) {
+    buffer_t *pbuf = buffers.Get();
+    pbuf->os << '\n';
+    if ((nlevel <= LOG_INFO) || ((size_t)pbuf->os.tellp() >= LOG_BUFFER_SIZE)) {
+        lock_guard<mutex> lock(buffers.Mutex());
+        _write(pbuf, nlevel == LOG_ERROR);
+    }
+}
+
+
+void Log::Flush() {
+    lock_guard<mutex> lock(buffers.Mutex());
+    for (size_t n = 0; n < buffers.size(); ++n) {
+        if (buffers[n].os.tellp() > 0)
+            _write(&buffers[n], false);
+    }
+}
+
+
+string log_bin(unsigned long long nval, int nbits) {
+    string s = "0b";
+    for (int i = min(nbits, 64) - 1; i >= 0; --i)
+        s += (char)('0' + ((nval >> i) & 1));
+    return s;
+}
+
+
+int log_level(const string& sname) {
+    static const char *snames[] = {"error", "info", "debug", "trace"};
+    for (int n = 0; n < 4; ++n) {
+        if (sname == snames[n])
+            return n;
+    }
+    return -1;
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ *    log.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LOG_H_
+#define LOG_H_
+
+
+#include <sstream>
+#include <string>
+
+#include "globals.h"
+#include "threadbuf.h"
+
+
+using namespace std;
+
+
+// bytes a thread collects before they are written
+#define LOG_BUFFER_SIZE 65536
+
+// highest level compiled in (make NODEBUGLOG=1 removes all debug and trace messages)
+#ifdef NO_DEBUG_LOG
+#define LOG_MAX LOG_INFO
+#else
+#define LOG_MAX LOG_TRACE
+#endif
+
+
+// writes a message of a subsystem (out is a stream expression, without endl)
+//  only formatted if the level of the subsystem allows it, levels above LOG_MAX are compiled out
+#define log_to(plog, nsub, nlevel, out) if (((nlevel) <= LOG_MAX) && (plog)->On(nsub, nlevel)) { \
+    (plog)->Begin() << out; (plog)->End(nlevel); }
+#define log_msg(nsub, nlevel, out) log_to(ctx.plog, nsub, nlevel, out)
+
+
+// messages of one run (written to ctx.pout, errors to ctx.perr)
+//  each thread collects its messages in its own buffer, no locking until it is written:
+//  at once for infos and errors (with everything before them), else when it is full
+class Log
+{
+    typedef struct buffer {
+        ostringstream os;
+        size_t nmark;       // start of the current message
+    } buffer_t;
+
+    const context_t& ctx;
+    ThreadBuffers<buffer_t> buffers;    // one for each thread (its mutex guards the output too)
+
+    void _write(buffer_t *pbuf, bool berror);
+
+public:
+    Log(const context_t& ctx);
+    ~Log();
+    Log(const Log&) = delete;
+    Log& operator=(const Log&) = delete;
+
+    // level of a subsystem (--log, else from --debug and --silent)
+    int Level(int nsub) const {
+        const config_t& cfg = ctx.cfg;
+        if (cfg.nloglevels[nsub] >= 0)
+            return cfg.nloglevels[nsub];
+        bool bflag = (nsub == LOG_LOADER) ? cfg.d_flags.l : (nsub == LOG_PARSER) ? cfg.d_flags.p : cfg.d_flags.g;
+        if (cfg.d || bflag)
+            return LOG_DEBUG;
+        return cfg.s ? LOG_ERROR : LOG_INFO;
+    }
+    bool On(int nsub, int nlevel) const { return (nlevel <= LOG_MAX) && (nlevel <= Level(nsub)); }
+
+    // a message: Begin() << ...; End(level);
+    ostream& Begin();
+    void End(int nlevel);
+    // writes the buffers of all threads (the others must have finished)
+    void Flush();
+};
+
+
+// flushes the log at the end of the scope (does nothing without a log)
+class LogFlush
+{
+    Log *plog;
+
+public:
+    LogFlush(Log *plog) : plog(plog) {}
+    ~LogFlush() {
+        if (plog)
+            plog->Flush();
+    }
+    LogFlush(const LogFlush&) = delete;
+    LogFlush& operator=(const LogFlush&) = delete;
+};
+
+
+// value as "0b..." with nbits digits (up to 64)
+string log_bin(unsigned long long nval, int nbits);
+
+// level from its name ("error", "info", "debug" or "trace"), -1 if unknown
+int log_level(const string& sname);
+
+
+#endif /* LOG_H_ */
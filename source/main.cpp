@@ -18,40 +18,87 @@
  *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 
-#include "Loader.h"
-#include "Parser.h"
+#include "batch.h"
 #include "globals.h"
-
-// config
-config_t g_cfg;
-// holds all loaded file names
-vector<string> g_vfiles;
-// holds all loaded code lines
-vector<mcLines> g_vlines;
+#include "log.h"
+#include "mcasm.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
 
 
 void print_help() {
 	cout << "Usage: mcasm [options] [source] [target]" << endl;
+	cout << "       mcasm [options] --batch=[joblist]" << endl;
 	cout << "  source is mandatory" << endl;
 	cout << "  target is optional" << endl;
 	cout << "Options:" << endl;
-//	cout << "  -f=[format]             Outputformat:" << endl;
-//	cout << "      logisim                 Logisim v2.0 raw (default)" << endl;
+	cout << "  -b [file]               Compile all jobs of the list [file], one per line:" << endl;
+	cout << "      source [target] [format]    ('#' starts a comment)" << endl;
+	cout << "  --batch=[file]          Same as -b [file]" << endl;
+	cout << "  -f=[format]             Outputformat:" << endl;
+	cout << "      logisim                 Logisim v2.0 raw (default)" << endl;
 //	cout << "      hex                     Intel hex" << endl;
-//	cout << "      bin                     Binary" << endl;
+	cout << "      bin                     Binary (little endian)" << endl;
+	cout << "  --chip=[N],[M],...      Only generate, verify or merge these chips," << endl;
+	cout << "                          the files of the other chips are not touched" << endl;
+	cout << "  --coverage              Only print the addresses each op wins, shadowed ops" << endl;
+	cout << "                          and what is left to #defaults (computed, not generated)" << endl;
 	cout << "  -d, --debug             Print lots of debugging information" << endl;
+	cout << "  -D[name]=[value]        Use value for the definition name" << endl;
+	cout << "  --diff [old source]     Only print the address regions where source differs" << endl;
+	cout << "                          from old source (op names and changed signals)" << endl;
 	cout << "  --debug=[FLAGS]         Print lots of debugging information during..." << endl;
 	cout << "      l                       ...file load" << endl;
 	cout << "      p                       ...parsing" << endl;
 	cout << "      g                       ...generating" << endl;
+	cout << "  --estimate              Only print what compiling would cost (addresses, memory," << endl;
+	cout << "                          size of the files and the time)" << endl;
 	cout << "  -h, --help              Print this message" << endl;
+	cout << "  -j[N], --jobs=[N]       Use up to N threads (default: number of cores)" << endl;
+	cout << "  --log=[S]:[LEVEL],...   Log level of the subsystems l, p and g (see --debug):" << endl;
+	cout << "                          error, info, debug or trace (g: every match)" << endl;
+	cout << "  --lookup [address]      Only print what the address gives (op, words, signals)" << endl;
+	cout << "                          '-' reads addresses from stdin (one per line, 'q' quits)" << endl;
+	cout << "  --max-errors=[N]        Number of mismatches printed by --verify (default: 10)" << endl;
+	cout << "  --max-size=[N][K|M|G]   Refuse to compile if the image in memory or the files" << endl;
+	cout << "                          would get bigger (estimate, default: 2G, 0 = no limit)" << endl;
+	cout << "  --merge [target] [shards...]" << endl;
+	cout << "                          Put the shards of all chips together (any order)," << endl;
+	cout << "                          they must be complete, intact and must not overlap" << endl;
+	cout << "  -MD                     Write make dependencies to [source without extension].d" << endl;
+	cout << "  -MF [file]              Write make dependencies to [file]" << endl;
+	cout << "  --no-progress           No progress line (stderr) while generating for long" << endl;
+	cout << "  --patch=[file]          Write the changed addresses and their new words (--diff)" << endl;
+	cout << "  --range [first]:[last]  Generate only the addresses first..last (inclusive)" << endl;
+	cout << "                          as a shard for --merge (Logisim raw with a header)" << endl;
+	cout << "  --reference             Generate with the naive loop over all ops (slow," << endl;
+	cout << "                          the reference the fast paths are tested against)" << endl;
 	cout << "  -s, --silent, --quiet   Don't echo messages, only errors" << endl;
+	cout << "  -w, --watch             Stay resident and recompile when a source file changes" << endl;
+	cout << "  --stats                 Print the time of each phase, counters and the peak memory" << endl;
+	cout << "  --stats=json            The same as JSON (one line)" << endl;
+	cout << "  --trace=[file]          Write the spans of all phases and threads to file" << endl;
+	cout << "                          (Chrome trace event JSON, chrome://tracing, Perfetto)" << endl;
 	cout << "  -v, --version           Print the version info and exit" << endl;
+	cout << "  --verify                Compare the existing target files with the source" << endl;
+	cout << "                          (Logisim raw or binary), exit code != 0 if they differ" << endl;
+	cout << "  --variant [name]:-D[name]=[value],..." << endl;
+	cout << "                          Generate a variant with other values of definitions," << endl;
+	cout << "                          target gets the prefix 'name_' (or replaces %s)," << endl;
+	cout << "                          repeat it for more variants, the source is parsed once" << endl;
 	cout << "" << endl;
 	cout << "Report bugs to <pernicius@web.de>" << endl;
 	cout << "" << endl;
@@ -97,9 +144,209 @@ void print_version() {
 }
 
 
+// statistics and trace of the last run (--stats, --trace)
+void print_stats(Stats& stats, const string& format, Trace& trace, const string& trace_file) {
+	if (format == "json")
+		stats.PrintJson(cout);
+	else if (format == "text")
+		stats.Print(cout);
+	if (!trace_file.empty() && (trace.Write(trace_file) == -1))
+		cerr << "ERROR: Can't write trace: " << trace_file << endl;
+}
+
+
+// file name pattern of a variant: %s is replaced by the name, else "name_" is put in front
+string variant_pattern(const string& out_file, const string& name) {
+	size_t p = out_file.find("%s");
+	if (p != string::npos)
+		return out_file.substr(0, p) + name + out_file.substr(p + 2);
+	size_t d = out_file.find_last_of("/\\");
+	d = (d == string::npos) ? 0 : d + 1;
+	return out_file.substr(0, d) + name + "_" + out_file.substr(d);
+}
+
+
+// vschanged: watch mode, the files changed since the last run (empty the first time)
+int compile(Mcasm& mcasm, const string& in_file, const string& out_file, const string& format, vector<variant_t>& vvariants,
+		const vector<string>& vschanged) {
+	image_t image;
+
+	// one source, several sets of chip files
+	if (!vvariants.empty()) {
+		int nfailed = mcasm.CompileVariants(in_file, vvariants);
+		if (nfailed == -1)
+			return -1;
+		for (auto& var : vvariants) {
+			if ((var.nstatus != 1) || !mcasm.Config().s) {
+				ostream& os = (var.nstatus == 1) ? cout : cerr;
+				os << "=== Variant " << var.sname << ": " << ((var.nstatus == 1) ? "ok" : "FAILED") << endl;
+				os << var.slog;
+			}
+			if ((var.nstatus == 1) && (mcasm.Write(var.image, variant_pattern(out_file, var.sname), format) == -1))
+				return -1;
+		}
+		if (nfailed > 0)
+			return -1;
+	}
+	// watch mode: only what has changed since the last run
+	else if (mcasm.Config().w) {
+		if (mcasm.Update(in_file, vschanged, out_file, format) == -1)
+			return -1;
+	}
+	else {
+		if (mcasm.Compile(in_file, image) == -1)
+			return -1;
+		if (mcasm.Write(image, out_file, format) == -1)
+			return -1;
+	}
+
+	// make dependencies
+	if (!mcasm.Config().sdepfile.empty()) {
+		if (mcasm.WriteDepfile(mcasm.Config().sdepfile) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+
+// decimal, hex(0x..) or binary(0b..)
+int parse_number(const char *s, long long& val) {
+	char *end;
+	int base = 10;
+
+	if ((s[0] == '0') && ((s[1] == 'x') || (s[1] == 'X'))) {
+		base = 16;
+		s += 2;
+	}
+	else if ((s[0] == '0') && ((s[1] == 'b') || (s[1] == 'B'))) {
+		base = 2;
+		s += 2;
+	}
+	val = strtoll(s, &end, base);
+	if ((*s == 0) || (*end != 0))
+		return -1;
+	return 1;
+}
+
+
+// number with an optional K, M or G (1024 based)
+int parse_size(const string& arg, long long& val) {
+	string num = arg;
+	int shift = 0;
+	char c = num.empty() ? 0 : toupper(num.back());
+
+	if ((c == 'K') || (c == 'M') || (c == 'G')) {
+		shift = (c == 'K') ? 10 : (c == 'M') ? 20 : 30;
+		num.pop_back();
+	}
+	if ((parse_number(num.c_str(), val) == -1) || (val < 0) || (val > (LLONG_MAX >> shift)))
+		return -1;
+	val <<= shift;
+	return 1;
+}
+
+
+// name=value
+int parse_define(const string& def, string& name, long long& val) {
+	size_t p = def.find('=');
+
+	if ((p == 0) || (p == string::npos))
+		return -1;
+	name = def.substr(0, p);
+	return parse_number(def.c_str() + p + 1, val);
+}
+
+
+// name:-Dfoo=1,-Dbar=2
+int parse_variant(const string& arg, variant_t& var) {
+	size_t p = arg.find(':');
+	var.sname = arg.substr(0, p);
+	if (var.sname.empty())
+		return -1;
+	while (p != string::npos) {
+		size_t e = arg.find(',', p + 1);
+		string def = arg.substr(p + 1, (e == string::npos) ? string::npos : e - p - 1);
+		string name;
+		long long val;
+		p = e;
+		if (def.empty())
+			continue;
+		if ((def.compare(0, 2, "-D") != 0) || (parse_define(def.substr(2), name, val) == -1))
+			return -1;
+		var.moverrides[name] = val;
+	}
+	return 1;
+}
+
+
+// print what the address gives: op, words and all inputs/signals
+int lookup(Mcasm& mcasm, const string& addr) {
+	long long naddr;
+	lookup_t res;
+
+	if (parse_number(addr.c_str(), naddr) == -1) {
+		cerr << "ERROR: Invalid address: " << addr << endl;
+		return -1;
+	}
+	auto start = chrono::steady_clock::now();
+	if (mcasm.Lookup(naddr, res) == -1)
+		return -1;
+	auto usecs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+	printf("0x%X: %s", res.naddr, (res.nop >= 0) ? res.sop.c_str() : "(no match, defaults)");
+	if (!mcasm.Config().s)
+		printf("  [%.1f us]", usecs);
+	printf("\n");
+	for (auto& f : res.vinputs)
+		printf("  in   %-16s = 0x%X\n", f.sname.c_str(), f.nval);
+	for (size_t x = 0; x < res.vnwords.size(); ++x) {
+		printf("  chip %d: 0x%X\n", (int)x, res.vnwords[x]);
+		for (auto& f : res.vsignals) {
+			if (f.nchip == (int)x)
+				printf("    %-16s = 0x%X\n", f.sname.c_str(), f.nval);
+		}
+	}
+	fflush(stdout);
+	return 1;
+}
+
+
+// [source without extension].d
+string default_depfile(const string& in_file) {
+	size_t p = in_file.find_last_of('.');
+	size_t d = in_file.find_last_of("/\\");
+	if ((p == string::npos) || ((d != string::npos) && (p < d)))
+		return in_file + ".d";
+	return in_file.substr(0, p) + ".d";
+}
+
+
 int main (int argc, char * const argv[]) {
+	Mcasm mcasm;
+	config_t& cfg = mcasm.Config();
+	cfg.p = true; // progress of long runs (--no-progress)
 	string in_file;
 	string out_file;
+	string format = "logisim";
+	string batch_file;
+	vector<variant_t> vvariants;
+	vector<string> vlookups;
+	bool bverify = false;
+	int max_errors = 10;
+	string diff_file;
+	string merge_file;
+	vector<string> vshards;
+	bool brange = false;
+	vector<int> vchips;
+	Stats stats;
+	string stats_format;
+	Trace trace;
+	string trace_file;
+	string patch_file;
+	vector<pair<string, long long> > vdefines;
+	bool bdeps = false;
+	bool bestimate = false;
+	bool bcoverage = false;
 
 	// check num of arguments
 	if (argc < 2) {
@@ -108,14 +355,6 @@ int main (int argc, char * const argv[]) {
 		return -1;
 	}
 	else {
-		// defaults
-		g_cfg.d           = false; // debug
-		g_cfg.d_flags.set = false; // any flag is set?
-		g_cfg.d_flags.l   = false; // debug FileLoader
-		g_cfg.d_flags.p   = false; // debug Parser
-		g_cfg.d_flags.g   = false; // debug Generator
-		g_cfg.s           = false; // silent
-
 		// check cmdline options
 		for (int ac = 1; ac < argc; ac++) {
 			// print help
@@ -130,23 +369,251 @@ int main (int argc, char * const argv[]) {
 			}
 			// set debug mode
 			if ((0 == strcmp(argv[ac], "-d")) || (0 == strcmp(argv[ac], "--debug"))) {
-				g_cfg.d = true;
+				cfg.d = true;
 				continue;
 			}
 			if (0 == strncmp(argv[ac], "--debug=", 8)) {
 				string tst = argv[ac];
 				for (int n = 8; n < (int)tst.length(); n++) {
 					switch(tst[n]) {
-						case 'l': g_cfg.d_flags.set = g_cfg.d_flags.l = true; break;
-						case 'p': g_cfg.d_flags.set = g_cfg.d_flags.p = true; break;
-						case 'g': g_cfg.d_flags.set = g_cfg.d_flags.g = true; break;
+						case 'l': cfg.d_flags.set = cfg.d_flags.l = true; break;
+						case 'p': cfg.d_flags.set = cfg.d_flags.p = true; break;
+						case 'g': cfg.d_flags.set = cfg.d_flags.g = true; break;
 					}
 				}
 				continue;
 			}
+			// log level of each subsystem
+			if (0 == strncmp(argv[ac], "--log=", 6)) {
+				string list(argv[ac] + 6);
+				size_t p = 0;
+				while (p != string::npos) {
+					size_t e = list.find(',', p);
+					string item = list.substr(p, (e == string::npos) ? string::npos : e - p);
+					const char *subs = "lpg";
+					const char *sub = (item.size() > 2) && (item[1] == ':') ? strchr(subs, item[0]) : NULL;
+					int level = (sub != NULL) ? log_level(item.substr(2)) : -1;
+					if ((sub == NULL) || (*sub == 0) || (level == -1)) {
+						cerr << "ERROR: Invalid log levels: " << argv[ac] << endl;
+						return -1;
+					}
+					cfg.nloglevels[sub - subs] = level;
+					p = (e == string::npos) ? e : e + 1;
+				}
+				continue;
+			}
 			// set silent mode
 			if ((0 == strcmp(argv[ac], "-s")) || (0 == strcmp(argv[ac], "--silent")) || (0 == strcmp(argv[ac], "--quiet"))) {
-				g_cfg.s = true;
+				cfg.s = true;
+				continue;
+			}
+			// set watch mode
+			if ((0 == strcmp(argv[ac], "-w")) || (0 == strcmp(argv[ac], "--watch"))) {
+				cfg.w = true;
+				continue;
+			}
+			// number of threads
+			if ((0 == strncmp(argv[ac], "-j", 2)) || (0 == strncmp(argv[ac], "--jobs=", 7))) {
+				const char *n = argv[ac] + ((argv[ac][1] == 'j') ? 2 : 7);
+				cfg.nthreads = max(1, atoi(n));
+				continue;
+			}
+			// override a definition
+			if (0 == strncmp(argv[ac], "-D", 2)) {
+				string name;
+				long long val;
+				if (parse_define(argv[ac] + 2, name, val) == -1) {
+					cerr << "ERROR: Invalid definition: " << argv[ac] << endl;
+					return -1;
+				}
+				mcasm.Define(name, val);
+				vdefines.push_back(make_pair(name, val));
+				continue;
+			}
+			// variants
+			if (0 == strncmp(argv[ac], "--variant=", 10)) {
+				variant_t var;
+				if (parse_variant(argv[ac] + 10, var) == -1) {
+					cerr << "ERROR: Invalid variant: " << argv[ac] << endl;
+					return -1;
+				}
+				vvariants.push_back(var);
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "--variant")) {
+				variant_t var;
+				if (++ac >= argc) {
+					print_help();
+					return -1;
+				}
+				if (parse_variant(argv[ac], var) == -1) {
+					cerr << "ERROR: Invalid variant: " << argv[ac] << endl;
+					return -1;
+				}
+				vvariants.push_back(var);
+				continue;
+			}
+			// verify mode
+			if (0 == strcmp(argv[ac], "--verify")) {
+				bverify = true;
+				continue;
+			}
+			if (0 == strncmp(argv[ac], "--max-errors=", 13)) {
+				max_errors = max(0, atoi(argv[ac] + 13));
+				continue;
+			}
+			// address range (shard)
+			if ((0 == strcmp(argv[ac], "--range")) || (0 == strncmp(argv[ac], "--range=", 8))) {
+				const char *arg = argv[ac] + 7;
+				if (*arg == '=')
+					++arg;
+				else if (++ac < argc)
+					arg = argv[ac];
+				else {
+					print_help();
+					return -1;
+				}
+				long long first, last;
+				string range(arg);
+				size_t p = range.find(':');
+				if ((p == string::npos) || (parse_number(range.substr(0, p).c_str(), first) == -1) ||
+						(parse_number(range.substr(p + 1).c_str(), last) == -1) ||
+						(first < 0) || (first > last) || (last > 0x7FFFFFFF)) {
+					cerr << "ERROR: Invalid address range: " << arg << endl;
+					return -1;
+				}
+				mcasm.SetRange((int)first, (int)last);
+				brange = true;
+				continue;
+			}
+			// statistics
+			if ((0 == strcmp(argv[ac], "--stats")) || (0 == strcmp(argv[ac], "--stats=json"))) {
+				stats_format = (argv[ac][7] == '=') ? "json" : "text";
+				mcasm.SetStats(&stats);
+				continue;
+			}
+			// pre-flight: refuse too big runs, only print the estimate, no progress line
+			if (0 == strncmp(argv[ac], "--max-size=", 11)) {
+				if (parse_size(argv[ac] + 11, cfg.nmaxbytes) == -1) {
+					cerr << "ERROR: Invalid size: " << argv[ac] << endl;
+					return -1;
+				}
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "--coverage")) {
+				bcoverage = true;
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "--estimate")) {
+				bestimate = true;
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "--no-progress")) {
+				cfg.p = false;
+				continue;
+			}
+			// reference engine
+			if (0 == strcmp(argv[ac], "--reference")) {
+				mcasm.SetReference(true);
+				continue;
+			}
+			// trace
+			if (0 == strncmp(argv[ac], "--trace=", 8)) {
+				trace_file = argv[ac] + 8;
+				mcasm.SetTrace(&trace);
+				continue;
+			}
+			// chip selection
+			if (0 == strncmp(argv[ac], "--chip=", 7)) {
+				string list(argv[ac] + 7);
+				size_t p = 0;
+				while (p != string::npos) {
+					size_t e = list.find(',', p);
+					long long chip;
+					if ((parse_number(list.substr(p, (e == string::npos) ? string::npos : e - p).c_str(), chip) == -1) ||
+							(chip < 0) || (chip > 0xFFFF)) {
+						cerr << "ERROR: Invalid chip list: " << argv[ac] << endl;
+						return -1;
+					}
+					vchips.push_back((int)chip);
+					p = (e == string::npos) ? e : e + 1;
+				}
+				mcasm.SelectChips(vchips);
+				continue;
+			}
+			// merge shards
+			if (0 == strcmp(argv[ac], "--merge")) {
+				if (++ac >= argc) {
+					print_help();
+					return -1;
+				}
+				merge_file = argv[ac];
+				continue;
+			}
+			// diff mode
+			if (0 == strcmp(argv[ac], "--diff")) {
+				if (++ac >= argc) {
+					print_help();
+					return -1;
+				}
+				diff_file = argv[ac];
+				continue;
+			}
+			if (0 == strncmp(argv[ac], "--patch=", 8)) {
+				patch_file = argv[ac] + 8;
+				continue;
+			}
+			// lookup mode
+			if (0 == strncmp(argv[ac], "--lookup=", 9)) {
+				vlookups.push_back(argv[ac] + 9);
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "--lookup")) {
+				if (++ac >= argc) {
+					print_help();
+					return -1;
+				}
+				vlookups.push_back(argv[ac]);
+				continue;
+			}
+			// make dependencies
+			if (0 == strcmp(argv[ac], "-MD")) {
+				bdeps = true;
+				continue;
+			}
+			if (0 == strcmp(argv[ac], "-MF")) {
+				if (++ac >= argc) {
+					print_help();
+					return -1;
+				}
+				cfg.sdepfile = argv[ac];
+				continue;
+			}
+			// output format
+			if (0 == strncmp(argv[ac], "-f=", 3)) {
+				format = argv[ac] + 3;
+				if ((format != "logisim") && (format != "bin")) {
+					cerr << "ERROR: Unknown output format: " << format << endl;
+					return -1;
+				}
+				continue;
+			}
+			// batch mode
+			if ((0 == strcmp(argv[ac], "-b")) || (0 == strncmp(argv[ac], "--batch=", 8))) {
+				if (argv[ac][1] == 'b') {
+					if (++ac >= argc) {
+						print_help();
+						return -1;
+					}
+					batch_file = argv[ac];
+				}
+				else
+					batch_file = argv[ac] + 8;
+				continue;
+			}
+			// all files are shards when merging
+			if (!merge_file.empty()) {
+				vshards.push_back(argv[ac]);
 				continue;
 			}
 			// is existing file?
@@ -174,50 +641,174 @@ int main (int argc, char * const argv[]) {
 		} // for
 	} // !(argc < 2)
 
+	// batch mode: the sources are in the job list
+	if (!batch_file.empty()) {
+		vector<job_t> vjobs;
+		batchopts_t opts;
+		if (!in_file.empty() || cfg.w || !cfg.sdepfile.empty()) {
+			print_help();
+			return -1;
+		}
+		if (!vvariants.empty() || brange || bverify || !vlookups.empty() || !diff_file.empty() ||
+				!merge_file.empty() || bestimate || bcoverage) {
+			cerr << "ERROR: --variant, --range, --verify, --lookup, --diff, --merge, --estimate and --coverage can't be used with --batch" << endl;
+			return -1;
+		}
+		if (read_joblist(batch_file, vjobs, cerr) == -1)
+			return -1;
+		for (auto& job : vjobs) {
+			if (bdeps)
+				job.sdepfile = default_depfile(job.ssource);
+		}
+		// -D, --chip, --stats and --trace apply to all jobs
+		opts.vdefines = vdefines;
+		opts.vnchips = vchips;
+		opts.pstats = stats_format.empty() ? NULL : &stats;
+		opts.ptrace = trace_file.empty() ? NULL : &trace;
+		int nfailed = run_batch(vjobs, cfg, opts);
+		print_stats(stats, stats_format, trace, trace_file);
+		return (nfailed == 0) ? 0 : -1;
+	}
+
+	// merge mode: the ROM from the shards of --range runs
+	if (!merge_file.empty()) {
+		image_t image;
+		if ((mcasm.Merge(vshards, image) == -1) || (mcasm.Write(image, merge_file, format) == -1))
+			return -1;
+		return 0;
+	}
+
 	// no source given :(
 	if(in_file.empty()) {
 		print_help();
 		return -1;
 	}
 
+	// lookup mode: parse only, then answer each address ('-' reads them from stdin)
+	if (!vlookups.empty()) {
+		if (mcasm.Open(in_file) == -1)
+			return -1;
+		for (auto& a : vlookups) {
+			if (a != "-") {
+				if (lookup(mcasm, a) == -1)
+					return -1;
+				continue;
+			}
+			string line;
+			while (getline(cin, line)) {
+				size_t p = line.find_first_not_of(" \t");
+				size_t e = line.find_last_not_of(" \t\r");
+				if (p == string::npos)
+					continue;
+				line = line.substr(p, e - p + 1);
+				if ((line == "q") || (line == "quit"))
+					break;
+				lookup(mcasm, line);
+			}
+		}
+		return 0;
+	}
+
+	// diff mode: what changes from the old source to the new one (both parsed only)
+	if (!diff_file.empty()) {
+		Mcasm old;
+		old.Config() = cfg;
+		old.SelectChips(vchips);
+		for (auto& d : vdefines)
+			old.Define(d.first, d.second);
+		if ((old.Open(diff_file) == -1) || (mcasm.Open(in_file) == -1))
+			return -1;
+		return (mcasm.Diff(old, patch_file) == -1) ? -1 : 0;
+	}
+
+	// coverage mode: what each op gets of the input space (parse only)
+	if (bcoverage) {
+		if ((mcasm.Open(in_file) == -1) || (mcasm.Coverage() == -1))
+			return -1;
+		return 0;
+	}
+
 	// default target
 	if(out_file.empty())
-		out_file = "rom%d.hex";
+		out_file = (format == "bin") ? "rom%d.bin" : "rom%d.hex";
+
+	// verify mode: compare the existing target files with the source
+	if (bverify) {
+		if (mcasm.Open(in_file) == -1)
+			return -1;
+		return (mcasm.Verify(out_file, max_errors) == 0) ? 0 : -1;
+	}
+
+	// shards have their own format
+	if (brange) {
+		if (format != "logisim") {
+			cerr << "ERROR: Shards (--range) are always written as Logisim raw with a header" << endl;
+			return -1;
+		}
+		format = "shard";
+	}
+	mcasm.SetFormat(format);
+
+	// estimate mode: what generating would cost (parse only)
+	if (bestimate) {
+		estimate_t est;
+		if (mcasm.Estimate(in_file, est) == -1)
+			return -1;
+		cout << "Addresses: " << est.naddrs << " (x " << est.nchips << " chip(s))" << endl;
+		cout << "Memory:    " << est.nmembytes << " bytes" << endl;
+		cout << "Output:    " << est.noutbytes << " bytes (" << format << ")" << endl;
+		cout << "Time:      ~" << fixed << setprecision(1) << est.dseconds << " s" << endl;
+		if ((cfg.nmaxbytes > 0) && (max(est.nmembytes, est.noutbytes) > cfg.nmaxbytes))
+			cout << "Over the limit of " << cfg.nmaxbytes << " bytes (--max-size), compiling would be refused" << endl;
+		return 0;
+	}
+
+	// default dependency file
+	if (bdeps && cfg.sdepfile.empty())
+		cfg.sdepfile = default_depfile(in_file);
 
 	// print debug config
-	if (g_cfg.d || g_cfg.d_flags.set) {
+	if (cfg.d || cfg.d_flags.set) {
 		cout << "Config used:" << endl;
-		cout << "  debug[" << (g_cfg.d ? "ON" : "OFF") << "]" << endl;
-		if (g_cfg.d_flags.set) {
-			cout << "    flag l [" << (g_cfg.d_flags.l ? "ON" : "OFF") << "]" << endl;
-			cout << "    flag p [" << (g_cfg.d_flags.p ? "ON" : "OFF") << "]" << endl;
-			cout << "    flag g [" << (g_cfg.d_flags.g ? "ON" : "OFF") << "]" << endl;
+		cout << "  debug[" << (cfg.d ? "ON" : "OFF") << "]" << endl;
+		if (cfg.d_flags.set) {
+			cout << "    flag l [" << (cfg.d_flags.l ? "ON" : "OFF") << "]" << endl;
+			cout << "    flag p [" << (cfg.d_flags.p ? "ON" : "OFF") << "]" << endl;
+			cout << "    flag g [" << (cfg.d_flags.g ? "ON" : "OFF") << "]" << endl;
+		}
+		cout << "  silent[" << (cfg.s ? "ON" : "OFF") << "]" << endl;
+		for (int n = 0; n < LOG_SUBSYSTEMS; ++n) {
+			static const char *levels[] = {"error", "info", "debug", "trace"};
+			cout << "  log " << "lpg"[n] << " [" << levels[mcasm.LogLevel(n)] << "]" << endl;
 		}
-		cout << "  silent[" << (g_cfg.s ? "ON" : "OFF") << "]" << endl;
+#ifdef NO_DEBUG_LOG
+		cout << "  (debug messages are not compiled in)" << endl;
+#endif
+		cout << "  watch[" << (cfg.w ? "ON" : "OFF") << "]" << endl;
+		cout << "  threads[" << cfg.nthreads << "]" << endl;
 		cout << "  source: ";
 		if(!in_file.empty()) cout << in_file << endl; else cout << "unset!" << endl;
-		cout << "  target: " << out_file << endl;
+		cout << "  target: " << out_file << " (" << format << ")" << endl;
+		if (!cfg.sdepfile.empty())
+			cout << "  dependencies: " << cfg.sdepfile << endl;
 	}
 
-	// load source
-	Loader*loader = new Loader();
-	if (loader->LoadFile(in_file.c_str()) == -1) {
-		return -1;
-	}
-	g_vlines = loader->v_mclines;
-	delete loader;
+	// first run
+	vector<string> vschanged;
+	int ret = compile(mcasm, in_file, out_file, format, vvariants, vschanged);
+	print_stats(stats, stats_format, trace, trace_file);
 
-	// Parse
-	Parser*parser = new Parser();
-	if (parser->Parse() == -1) {
-		return -1;
+	// watch mode: recompile on every change of a loaded file
+	while (cfg.w) {
+		if (!cfg.s)
+			cout << "Watching " << mcasm.Files().size() << " file(s) for changes..." << endl;
+		if (watch_files(mcasm.Files(), mcasm.Messages(), vschanged) == -1)
+			return -1;
+		stats.Reset();
+		trace.Reset();
+		ret = compile(mcasm, in_file, out_file, format, vvariants, vschanged);
+		print_stats(stats, stats_format, trace, trace_file);
 	}
 
-	// Generate
-	if (parser->Generate(out_file.c_str()) == -1) {
-		return -1;
-	}
-
-	delete parser; // will be deleted after generator because it holds all the parsed data
-	return 0;
+	return ret;
 }
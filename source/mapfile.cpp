@@ -0,0 +1,101 @@
+/*
+ *
+ *    mapfile.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mapfile.h"
+
+
+MappedFile::MappedFile() {
+    pdata = NULL;
+    nsize = 0;
+    bmapped = false;
+}
+
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+
+// returns -1 if the file can't be opened
+int MappedFile::Open(const string& sname) {
+    Close();
+#ifdef __unix__
+    int fd = open(sname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    nsize = st.st_size;
+    if (nsize > 0) {
+        void *p = mmap(NULL, nsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            pdata = (const char *)p;
+            bmapped = true;
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+#endif
+    // not mapped: read it
+    FILE *pfile = fopen(sname.c_str(), "rb");
+    char *buf;
+    if (pfile == NULL)
+        return -1;
+    fseek(pfile, 0, SEEK_END);
+    nsize = ftell(pfile);
+    fseek(pfile, 0, SEEK_SET);
+    buf = (char *)malloc(nsize + 1);
+    if ((buf == NULL) || (fread(buf, 1, nsize, pfile) != nsize)) {
+        free(buf);
+        fclose(pfile);
+        nsize = 0;
+        return -1;
+    }
+    fclose(pfile);
+    pdata = buf;
+    return 1;
+}
+
+
+void MappedFile::Close() {
+#ifdef __unix__
+    if (bmapped)
+        munmap((void *)pdata, nsize);
+#endif
+    if (!bmapped)
+        free((void *)pdata);
+    pdata = NULL;
+    nsize = 0;
+    bmapped = false;
+}
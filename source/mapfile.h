@@ -0,0 +1,53 @@
+/*
+ *
+ *    mapfile.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MAPFILE_H_
+#define MAPFILE_H_
+
+
+#include <cstddef>
+#include <string>
+
+
+using namespace std;
+
+
+// read only view of a whole file (memory mapped if possible, else read into a buffer)
+class MappedFile
+{
+    const char *pdata;  // content
+    size_t nsize;       // size in bytes
+    bool bmapped;       // pdata is mapped (else allocated)
+
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    int Open(const string& sname);
+    void Close();
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nsize; }
+};
+
+
+#endif /* MAPFILE_H_ */
@@ -0,0 +1,126 @@
+/*
+ *
+ *    matcher.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+#include <climits>
+
+#include "matcher.h"
+
+
+Matcher::Matcher() {
+    nival = NULL;
+    nimask = NULL;
+    nop = NULL;
+    vnfirst.assign(2, 0);
+}
+
+
+// bucket of an address: the selected bits, packed
+int Matcher::_bucket(int naddr) const {
+    int b = 0;
+    for (size_t i = 0; i < vnbits.size(); ++i)
+        b |= ((naddr >> vnbits[i]) & 1) << i;
+    return b;
+}
+
+
+void Matcher::Build(int ncubes, const int *nival, const int *nimask, const int *nop, int naddrbits) {
+    vector<int> vncount(naddrbits, 0);
+    vector<int> vnorder;
+
+    this->nival = nival;
+    this->nimask = nimask;
+    this->nop = nop;
+
+    // the bits most cubes care about split the cubes best
+    for (int c = 0; c < ncubes; ++c) {
+        for (int b = 0; b < naddrbits; ++b)
+            vncount[b] += (nimask[c] >> b) & 1;
+    }
+    for (int b = 0; b < naddrbits; ++b) {
+        if (vncount[b] > 0)
+            vnorder.push_back(b);
+    }
+    stable_sort(vnorder.begin(), vnorder.end(), [&](int a, int b) {
+        return vncount[a] > vncount[b];
+    });
+    vnbits.assign(vnorder.begin(), vnorder.begin() + min((int)vnorder.size(), MATCHER_BITS));
+
+    // a cube goes into all buckets its value/mask allows (two passes: count, fill)
+    //  or into the wide list if that would be too many
+    int nbuckets = 1 << vnbits.size();
+    vnfirst.assign(nbuckets + 1, 0);
+    vnwide.clear();
+    for (int pass = 0; pass < 2; ++pass) {
+        vector<int> vnnext(vnfirst.begin(), vnfirst.end() - 1);
+        for (int c = 0; c < ncubes; ++c) {
+            int nbase = _bucket(nival[c]);
+            int nfree = (nbuckets - 1) & ~_bucket(nimask[c]);
+            if (__builtin_popcount(nfree) > MATCHER_MAX_FREE) {
+                if (pass == 0)
+                    vnwide.push_back(c);
+                continue;
+            }
+            for (int sub = nfree; ; sub = (sub - 1) & nfree) {
+                if (pass == 0)
+                    ++vnfirst[(nbase | sub) + 1];
+                else
+                    vncubes[vnnext[nbase | sub]++] = c;
+                if (sub == 0)
+                    break;
+            }
+        }
+        if (pass == 0) {
+            for (int b = 0; b < nbuckets; ++b)
+                vnfirst[b + 1] += vnfirst[b];
+            vncubes.resize(vnfirst[nbuckets]);
+        }
+    }
+}
+
+
+// index of the first matching op, -1 if none
+//  pnprobes (if not NULL) gets the number of cubes compared added
+int Matcher::Find(int naddr, long long *pnprobes) const {
+    int b = _bucket(naddr);
+    int nfound = INT_MAX;   // first matching cube
+    int i, w;
+
+    // wide cubes first (a few, often early catch-alls), the bucket only up to the one found
+    for (w = 0; w < (int)vnwide.size(); ++w) {
+        int c = vnwide[w];
+        if ((naddr & nimask[c]) == nival[c]) {
+            nfound = c;
+            ++w;
+            break;
+        }
+    }
+    for (i = vnfirst[b]; (i < vnfirst[b + 1]) && (vncubes[i] < nfound); ++i) {
+        int c = vncubes[i];
+        if ((naddr & nimask[c]) == nival[c]) {
+            nfound = c;
+            ++i;
+            break;
+        }
+    }
+    if (pnprobes)
+        *pnprobes += w + (i - vnfirst[b]);
+    return (nfound == INT_MAX) ? -1 : nop[nfound];
+}
@@ -0,0 +1,64 @@
+/*
+ *
+ *    matcher.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MATCHER_H_
+#define MATCHER_H_
+
+
+#include <cstddef>
+#include <vector>
+
+
+using namespace std;
+
+
+// max. number of address bits used to select a bucket
+#define MATCHER_BITS 10
+
+// cubes not caring about more of these bits are not copied into the buckets
+//  (up to 2^MATCHER_BITS of them) but kept in one list checked after the bucket
+#define MATCHER_MAX_FREE 3
+
+
+// finds the first op matching an address without looking at all the cubes
+//  the cubes are sorted into buckets by the address bits most of them use,
+//  each bucket holds (in order) only the cubes that can match it,
+//  cubes matching many buckets are in one list for all of them
+class Matcher
+{
+    vector<int> vnbits;     // address bits selecting the bucket
+    vector<int> vnfirst;    // first entry of each bucket in vncubes [nbuckets + 1]
+    vector<int> vncubes;    // cube indices of all buckets
+    vector<int> vnwide;     // cube indices not in the buckets (in order)
+    const int *nival;       // value of each cube
+    const int *nimask;      // mask of each cube
+    const int *nop;         // op of each cube
+
+    int _bucket(int naddr) const;
+
+public:
+    Matcher();
+
+    void Build(int ncubes, const int *nival, const int *nimask, const int *nop, int naddrbits);
+    int Find(int naddr, long long *pnprobes = NULL) const;
+};
+
+
+#endif /* MATCHER_H_ */
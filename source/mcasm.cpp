@@ -0,0 +1,1268 @@
+/*
+ *
+ *    mcasm.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "mcasm.h"
+#include "mapfile.h"
+#include "trace.h"
+
+// some message macros
+#define silent(out) log_msg(LOG_GENERATOR, LOG_INFO, out)
+#define error(out)  log_msg(LOG_GENERATOR, LOG_ERROR, "ERROR: " << out)
+#define warning(out) log_msg(LOG_GENERATOR, LOG_ERROR, "WARNING: " << out)
+
+
+Mcasm::Mcasm() : log(ctx) {
+    ctx.cfg.d           = false; // debug
+    ctx.cfg.d_flags.set = false; // any flag is set?
+    ctx.cfg.d_flags.l   = false; // debug FileLoader
+    ctx.cfg.d_flags.p   = false; // debug Parser
+    ctx.cfg.d_flags.g   = false; // debug Generator
+    ctx.cfg.s           = false; // silent
+    for (auto& l : ctx.cfg.nloglevels)
+        l = -1;                      // log levels from the flags above
+    ctx.cfg.w           = false; // watch mode
+    ctx.cfg.p           = false; // progress
+    ctx.cfg.nmaxbytes   = DEFAULT_LIMIT; // refuse bigger images and files
+    ctx.cfg.nthreads    = max(1, (int)thread::hardware_concurrency());
+    ctx.pout = &cout;
+    ctx.perr = &cerr;
+    ctx.pcache = NULL;
+    ctx.pstats = NULL;
+    ctx.ptrace = NULL;
+    ctx.plog = &log;
+    nfirst = 0;
+    nlast = -1;
+    breference = false;
+    sformat = "logisim";
+    bwatchfiles = false;
+    ctx.readfile = [this](const string& sname, string& sdata) {
+        return _readFile(sname, sdata);
+    };
+}
+
+
+void Mcasm::SetOutput(ostream *pout, ostream *perr) {
+    ctx.pout = pout;
+    ctx.perr = perr;
+}
+
+
+// in-memory file, used instead of the one on disk (or from the callback)
+void Mcasm::SetFile(const string& sname, const string& sdata) {
+    mfiles[sname] = sdata;
+}
+
+
+void Mcasm::ClearFiles() {
+    mfiles.clear();
+}
+
+
+void Mcasm::SetReadFile(readfile_t callback) {
+    readfile = callback;
+}
+
+
+// share the cleaned lines of loaded files with other objects
+void Mcasm::SetCache(LineCache *pcache) {
+    ctx.pcache = pcache;
+}
+
+
+// collect times and counters (NULL = off)
+void Mcasm::SetStats(Stats *pstats) {
+    ctx.pstats = pstats;
+}
+
+
+// record spans (NULL = off)
+void Mcasm::SetTrace(Trace *ptrace) {
+    ctx.ptrace = ptrace;
+}
+
+
+// value of a definition, used instead of the one in the source
+void Mcasm::Define(const string& sname, long long nval) {
+    mdefines[sname] = nval;
+}
+
+
+void Mcasm::SetRange(int nfirst, int nlast) {
+    this->nfirst = nfirst;
+    this->nlast = nlast;
+}
+
+
+void Mcasm::SetReference(bool breference) {
+    this->breference = breference;
+}
+
+
+void Mcasm::SetFormat(const string& sformat) {
+    this->sformat = sformat;
+}
+
+
+void Mcasm::SelectChips(const vector<int>& vnchips) {
+    vbchips.clear();
+    for (auto x : vnchips) {
+        if ((size_t)x >= vbchips.size())
+            vbchips.resize(x + 1, false);
+        vbchips[x] = true;
+    }
+}
+
+
+// in-memory files first, then the callback or the disk
+int Mcasm::_readFile(const string& sname, string& sdata) {
+    auto it = mfiles.find(sname);
+    if (it != mfiles.end()) {
+        sdata = it->second;
+        return 1;
+    }
+    // watch mode: unchanged since the last update
+    if (bwatchfiles) {
+        it = mwatchfiles.find(sname);
+        if (it != mwatchfiles.end()) {
+            sdata = it->second;
+            return 1;
+        }
+    }
+    int ret = readfile ? readfile(sname, sdata) : read_file(sname, sdata);
+    if (bwatchfiles && (ret == 1))
+        mwatchfiles[sname] = sdata;
+    return ret;
+}
+
+
+// load source (from scratch)
+int Mcasm::_load(const string& sfile) {
+    pparser.reset();
+    ctx.vfiles.clear();
+    ctx.vlines.clear();
+    vstargets.clear();
+
+    Loader loader(ctx);
+    if (loader.LoadFile(sfile.c_str()) == -1)
+        return -1;
+    ctx.vlines.swap(loader.v_mclines);
+
+    // tokens of the cleaned lines (only counted for the statistics)
+    if (ctx.pstats) {
+        long long ntokens = 0;
+        for (auto& l : ctx.vlines) {
+            Lexer lex(l.sline);
+            while (lex.Next().type != TOK_END)
+                ++ntokens;
+        }
+        ctx.pstats->Add("lines", ctx.vlines.size());
+        ctx.pstats->Add("tokens", ntokens);
+    }
+    return 1;
+}
+
+
+// bytes as B, KB, MB or GB
+static string size_str(long long nbytes) {
+    static const char *sunits[] = {"B", "KB", "MB", "GB", "TB"};
+    double d = (double)nbytes;
+    int u = 0;
+    char buf[32];
+
+    while ((d >= 1024.0) && (u < 4)) {
+        d /= 1024.0;
+        ++u;
+    }
+    snprintf(buf, sizeof(buf), (u == 0) ? "%.0f %s" : "%.1f %s", d, sunits[u]);
+    return buf;
+}
+
+
+// sizes from the parsed source, the time from ESTIMATE_SAMPLES addresses spread over
+//  the range (generated and formatted like the output), ncopies images (variants)
+void Mcasm::_estimate(const Parser& parser, int ncopies, estimate_t& est) {
+    StatsTimer t(ctx.pstats, "estimate");
+    long long nmax = (1LL << parser.AddrBits()) - 1;
+    long long nend = ((nlast < 0) || (nlast > nmax)) ? nmax : nlast;
+    long long nbegin = min((long long)nfirst, nend);
+    int nwordbytes = (parser.WordBits() + 7) / 8;
+    vector<int> vnchips;
+
+    for (int x = 0; x < parser.Chips(); ++x) {
+        if (vbchips.empty() || (((size_t)x < vbchips.size()) && vbchips[x]))
+            vnchips.push_back(x);
+    }
+    est.naddrs = nend - nbegin + 1;
+    est.nchips = vnchips.size();
+    est.nmembytes = est.naddrs * parser.Chips() * (long long)sizeof(int) * ncopies;
+
+    // calibration
+    long long nsamples = min(est.naddrs, (long long)ESTIMATE_SAMPLES);
+    long long nchars = 0;
+    char buf[32];
+    auto tstart = chrono::steady_clock::now();
+    vector<int> vnwords;
+    vnwords.reserve(nsamples * vnchips.size());
+    for (long long n = 0; n < nsamples; ++n) {
+        int naddr = (int)(nbegin + n * est.naddrs / nsamples);
+        int nop;
+        const int *nsignals = breference ? parser.ExpectReference(naddr, &nop) : parser.Expect(naddr, &nop);
+        for (auto x : vnchips)
+            vnwords.push_back(nsignals[x]);
+    }
+    auto tgen = chrono::steady_clock::now();
+    if (sformat != "bin") {
+        for (auto w : vnwords)
+            nchars += snprintf(buf, sizeof(buf), "%X\n", w);
+    }
+    auto tout = chrono::steady_clock::now();
+    double dgen = chrono::duration<double>(tgen - tstart).count() / max(1LL, nsamples);
+    double dout = chrono::duration<double>(tout - tgen).count() / max(1LL, nsamples);
+
+    // logisim and shards: hex digits of the sampled words (+ header)
+    if (sformat == "bin")
+        est.noutbytes = est.naddrs * nwordbytes * est.nchips;
+    else
+        est.noutbytes = (long long)((double)nchars / max(1LL, nsamples) * est.naddrs) + 128 * est.nchips;
+    est.noutbytes *= ncopies;
+    est.dseconds = (dgen + dout) * est.naddrs * ncopies;
+}
+
+
+// estimate before generating, -1 if it is over the limit
+int Mcasm::_preflight(const Parser& parser, int ncopies) {
+    estimate_t est;
+    _estimate(parser, ncopies, est);
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", est.dseconds);
+    string sest = to_string(est.naddrs) + " address(es) x " + to_string(est.nchips) + " chip(s), "
+                  + size_str(est.nmembytes) + " in memory, " + size_str(est.noutbytes) + " of " + sformat
+                  + " files, ~" + buf + " s";
+    if ((ctx.cfg.nmaxbytes > 0) && (max(est.nmembytes, est.noutbytes) > ctx.cfg.nmaxbytes)) {
+        error("Too big: " << sest << " (limit " << size_str(ctx.cfg.nmaxbytes) << ", see --max-size)");
+        return -1;
+    }
+    // (only worth a line if it takes a while)
+    if (est.dseconds >= 1.0) {
+        silent("Estimate: " << sest);
+    }
+    else {
+        log_msg(LOG_GENERATOR, LOG_DEBUG, "Estimate: " << sest);
+    }
+    return 1;
+}
+
+
+int Mcasm::Estimate(const string& sfile, estimate_t& est) {
+    LogFlush flush(ctx.plog);
+    if (_load(sfile) == -1)
+        return -1;
+
+    Parser parser(ctx);
+    parser.SetOverrides(&mdefines);
+    parser.SelectChips(vbchips);
+    if (parser.Parse() == -1)
+        return -1;
+    _estimate(parser, 1, est);
+    return 1;
+}
+
+
+int Mcasm::Compile(const string& sfile, image_t& image) {
+    LogFlush flush(ctx.plog);
+    TraceSpan span(ctx.ptrace, "mcasm", "Compile");
+    span.Arg("file", sfile);
+    if (_load(sfile) == -1)
+        return -1;
+
+    // parse and generate
+    Parser parser(ctx);
+    parser.SetOverrides(&mdefines);
+    parser.SelectChips(vbchips);
+    parser.SetReference(breference);
+    if (parser.Parse() == -1)
+        return -1;
+    if (_preflight(parser, 1) == -1)
+        return -1;
+    if (parser.Build(image, nfirst, nlast) == -1)
+        return -1;
+
+    return 1;
+}
+
+
+int Mcasm::CompileVariants(const string& sfile, vector<variant_t>& vvariants) {
+    LogFlush flush(ctx.plog);
+    TraceSpan span(ctx.ptrace, "mcasm", "CompileVariants");
+    span.Arg("file", sfile);
+    atomic<size_t> nnext(0);
+    vector<thread> vthreads;
+    int npool = max(1, min(ctx.cfg.nthreads, (int)vvariants.size()));
+    int nfailed = 0;
+
+    if (_load(sfile) == -1)
+        return -1;
+
+    // parse once, remember what each op depends on
+    Parser base(ctx);
+    base.SetOverrides(&mdefines);
+    base.KeepOps();
+    base.SelectChips(vbchips);
+    if (base.Parse() == -1)
+        return -1;
+    if (_preflight(base, vvariants.size()) == -1)
+        return -1;
+
+    // each variant parses only the ops depending on changed definitions
+    for (int t = 0; t < npool; ++t) {
+        vthreads.push_back(thread([&]() {
+            size_t n;
+            while ((n = nnext.fetch_add(1)) < vvariants.size()) {
+                variant_t& var = vvariants[n];
+                map<string, long long> moverrides(var.moverrides);
+                ostringstream log;
+                context_t vctx = ctx;
+                Log vlog(vctx);
+
+                vctx.pout = &log;
+                vctx.perr = &log;
+                vctx.plog = &vlog;
+                vctx.cfg.nthreads = max(1, ctx.cfg.nthreads / npool);
+                vctx.cfg.p = false;     // no progress lines in the variant logs
+                moverrides.insert(mdefines.begin(), mdefines.end());
+
+                TraceSpan span(ctx.ptrace, "variant", "variant");
+                span.Arg("name", var.sname);
+                Parser parser(vctx);
+                parser.SetOverrides(&moverrides);
+                parser.SetBase(&base);
+                parser.SelectChips(vbchips);
+                parser.SetReference(breference);
+                var.nstatus = -1;
+                if ((parser.Parse() == 1) && (parser.Build(var.image, nfirst, nlast) == 1))
+                    var.nstatus = 1;
+                vlog.Flush();
+                var.slog = log.str();
+            }
+        }));
+    }
+    for (auto& t : vthreads)
+        t.join();
+
+    for (auto& var : vvariants) {
+        if (var.nstatus != 1)
+            ++nfailed;
+    }
+    return nfailed;
+}
+
+
+int Mcasm::Update(const string& sfile, const vector<string>& vschanged, const string& spattern, const string& sformat) {
+    LogFlush flush(ctx.plog);
+    TraceSpan span(ctx.ptrace, "mcasm", "Update");
+    span.Arg("file", sfile);
+
+    // load, the files not changed since the last update come from memory
+    if (!pwatch)
+        mwatchfiles.clear();
+    for (auto& f : vschanged)
+        mwatchfiles.erase(f);
+    // (the cache keeps every version, start again once it has more than a few)
+    LineCache *pcache = ctx.pcache;
+    if (!pcache) {
+        if (!pwatchcache || (pwatchcache->size() > 2 * ctx.vfiles.size() + 16))
+            pwatchcache.reset(new LineCache());
+        ctx.pcache = pwatchcache.get();
+    }
+    bwatchfiles = true;
+    int ret = _load(sfile);
+    bwatchfiles = false;
+    ctx.pcache = pcache;
+    if (ret == -1)
+        return -1;
+
+    // parse, unchanged #op blocks are taken from the last update
+    unique_ptr<Parser> parser(new Parser(ctx));
+    parser->SetOverrides(&mdefines);
+    parser->SelectChips(vbchips);
+    parser->SetReference(breference);
+    parser->KeepOps();
+    parser->SetPrevious(pwatch.get());
+    if (parser->Parse() == -1)
+        return -1;
+
+    // generate what the changed ops cover, everything if that's most of it anyway
+    vector<cube_t> vcubes;
+    vector<bool> vbwrite;
+    bool bfull = !pwatch || !parser->Changes(*pwatch, vcubes);
+    if (!bfull) {
+        int nfield = (parser->AddrBits() >= 31) ? 0x7FFFFFFF : ((1 << parser->AddrBits()) - 1);
+        long long naddrs = 0;
+        for (auto& c : vcubes)
+            naddrs += 1LL << (parser->AddrBits() - __builtin_popcount(c.nmask & nfield));
+        bfull = (naddrs > watchimage.nwords);
+    }
+    unsigned long long nsource = watchimage.nsource;
+    pwatch.reset();
+    if (bfull) {
+        if (_preflight(*parser, 1) == -1)
+            return -1;
+        if (parser->Build(watchimage, nfirst, nlast) == -1)
+            return -1;
+        vbwrite = watchimage.vbchips;
+    }
+    else {
+        long long naddrs = parser->Rebuild(watchimage, vcubes, vbwrite);
+        silent("Generated again: " << naddrs << " address(es) of " << vcubes.size() << " changed cube(s)");
+        // (each shard has the hash of the whole source)
+        if ((sformat == "shard") && (watchimage.nsource != nsource))
+            vbwrite.assign(vbwrite.size(), true);
+    }
+
+    // write the changed chips only (the files of the others are still right)
+    bool bwrite = false;
+    for (size_t x = 0; x < vbwrite.size(); ++x)
+        bwrite = bwrite || (vbwrite[x] && watchimage.vbchips[x]);
+    if (!bwrite) {
+        silent("No word has changed, nothing written");
+        pwatch.swap(parser);
+        return _targets(watchimage, spattern);
+    }
+    vector<bool> vbselected(watchimage.vbchips);
+    for (size_t x = 0; x < vbwrite.size(); ++x)
+        watchimage.vbchips[x] = vbwrite[x] && vbselected[x];
+    ret = Write(watchimage, spattern, sformat);
+    watchimage.vbchips.swap(vbselected);
+    // (the depfile names the files of all selected chips, not only the ones written)
+    if ((ret == -1) || (_targets(watchimage, spattern) == -1))
+        return -1;
+    pwatch.swap(parser);
+    return 1;
+}
+
+
+int Mcasm::Open(const string& sfile) {
+    LogFlush flush(ctx.plog);
+    if (_load(sfile) == -1)
+        return -1;
+
+    unique_ptr<Parser> parser(new Parser(ctx));
+    parser->SetOverrides(&mdefines);
+    parser->SelectChips(vbchips);
+    if (parser->Parse() == -1)
+        return -1;
+    pparser.swap(parser);
+    return 1;
+}
+
+
+int Mcasm::Lookup(long long naddr, lookup_t& res) {
+    LogFlush flush(ctx.plog);
+    if (!pparser) {
+        error("No source opened");
+        return -1;
+    }
+    // (checked before it's cut to an int)
+    long long nmax = (1LL << pparser->AddrBits()) - 1;
+    if ((naddr < 0) || (naddr > nmax)) {
+        error("Address out of range (0.." << nmax << ")");
+        return -1;
+    }
+    return pparser->Lookup((int)naddr, res);
+}
+
+
+// Logisim v2.0 raw: hex values separated by white space, "n*value" repeats the value
+//  '#' starts a comment, missing words at the end are 0, returns the number of words read
+static int parse_logisim(const char *p, size_t nsize, vector<int>& vnwords, string& serr) {
+    const char *end = p + nsize;
+    size_t naddr = 0;
+
+    // header
+    while ((p < end) && (*p != '\n'))
+        ++p;
+    while (p < end) {
+        // white space and comments
+        if ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n')) {
+            ++p;
+            continue;
+        }
+        if (*p == '#') {
+            while ((p < end) && (*p != '\n'))
+                ++p;
+            continue;
+        }
+        // [count*]value
+        const char *t = p;
+        while ((p < end) && (*p != ' ') && (*p != '\t') && (*p != '\r') && (*p != '\n') && (*p != '#'))
+            ++p;
+        string stok(t, p - t);
+        size_t nstar = stok.find('*');
+        unsigned long long ncount = 1;
+        char *e;
+        if (nstar != string::npos) {
+            ncount = strtoull(stok.c_str(), &e, 10);
+            if ((nstar == 0) || (e != stok.c_str() + nstar)) {
+                serr = "invalid entry '" + stok + "'";
+                return -1;
+            }
+            ++nstar;
+        } else {
+            nstar = 0;
+        }
+        unsigned long long nval = strtoull(stok.c_str() + nstar, &e, 16);
+        if ((nstar >= stok.size()) || (*e != 0)) {
+            serr = "invalid entry '" + stok + "'";
+            return -1;
+        }
+        if (naddr + ncount > vnwords.size()) {
+            serr = "more words than addresses";
+            return -1;
+        }
+        fill(vnwords.begin() + naddr, vnwords.begin() + naddr + ncount, (int)nval);
+        naddr += ncount;
+    }
+    return (int)naddr;
+}
+
+
+// a mismatching word
+typedef struct mismatch {
+    int naddr;
+    int nchip;
+    int nactual;
+    int nexpected;
+    int nop;
+} mismatch_t;
+
+
+int Mcasm::Verify(const string& spattern, int nmaxerrors) {
+    LogFlush flush(ctx.plog);
+    if (!pparser) {
+        error("No source opened");
+        return -1;
+    }
+    const Parser& parser = *pparser;
+    int nchips = parser.Chips();
+    int nwords = (int)(1LL << parser.AddrBits());  // (at most 2^30, see INPUTS_MAX_BIT)
+    int nbytes = (parser.WordBits() + 7) / 8;
+    vector<string> vsfiles(nchips);
+    vector<vector<int> > vvnwords(nchips);
+    vector<int> vnchips;    // the selected ones
+    for (int x = 0; x < nchips; ++x) {
+        if (vbchips.empty() || (((size_t)x < vbchips.size()) && vbchips[x]))
+            vnchips.push_back(x);
+    }
+
+    // load the files (Logisim is detected by its header, everything else is binary)
+    silent("Verifying...");
+    for (auto x : vnchips) {
+        MappedFile mf;
+        vvnwords[x].assign(nwords, 0);
+        string serr;
+        if (_fileName(spattern, x, vsfiles[x]) == -1)
+            return -1;
+        silent("File: " << vsfiles[x]);
+        if (mf.Open(vsfiles[x]) == -1) {
+            error("Can't open file: " << vsfiles[x]);
+            return -1;
+        }
+        if ((mf.size() >= 8) && (string(mf.data(), 8) == "v2.0 raw")) {
+            if (parse_logisim(mf.data(), mf.size(), vvnwords[x], serr) == -1) {
+                error(vsfiles[x] << ": " << serr);
+                return -1;
+            }
+            continue;
+        }
+        if (mf.size() != (size_t)nwords * nbytes) {
+            error(vsfiles[x] << ": size is " << mf.size() << " bytes, expected " << (size_t)nwords * nbytes
+                  << " (" << nwords << " words of " << nbytes << " bytes)");
+            return -1;
+        }
+        const unsigned char *pb = (const unsigned char *)mf.data();
+        for (int a = 0; a < nwords; ++a) {
+            int w = 0;
+            for (int b = 0; b < nbytes; ++b)
+                w |= pb[(size_t)a * nbytes + b] << (b * 8);
+            vvnwords[x][a] = w;
+        }
+    }
+
+    // compare in parallel, each chunk keeps its first mismatches
+    const int nchunk = 4096;
+    int nchunks = (nwords + nchunk - 1) / nchunk;
+    int nthreads = max(1, min(ctx.cfg.nthreads, nchunks));
+    vector<vector<mismatch_t> > vvmis(nchunks);
+    atomic<int> nnext(0);
+    atomic<int> nmismatches(0);
+    vector<thread> vthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        vthreads.push_back(thread([&]() {
+            TraceSpan span(ctx.ptrace, "verify", "verify worker");
+            int c;
+            while ((c = nnext.fetch_add(1)) < nchunks) {
+                int nlast = min(nwords, (c + 1) * nchunk);
+                int ncount = 0;
+                for (int a = c * nchunk; a < nlast; ++a) {
+                    int nop;
+                    const int *nexp = parser.Expect(a, &nop);
+                    for (auto x : vnchips) {
+                        if (vvnwords[x][a] == nexp[x])
+                            continue;
+                        ++ncount;
+                        if ((int)vvmis[c].size() < nmaxerrors) {
+                            mismatch_t m = {a, x, vvnwords[x][a], nexp[x], nop};
+                            vvmis[c].push_back(m);
+                        }
+                    }
+                }
+                nmismatches += ncount;
+            }
+        }));
+    }
+    for (auto& t : vthreads)
+        t.join();
+
+    // report the first ones (the chunks are in order of the addresses)
+    int nreported = 0;
+    for (int c = 0; (c < nchunks) && (nreported < nmaxerrors); ++c) {
+        for (auto& m : vvmis[c]) {
+            if (nreported++ >= nmaxerrors)
+                break;
+            string sdiff;
+            for (auto& sig : parser.Signals()) {
+                int mask = (sig.nnum >= 32) ? -1 : (int)((1u << sig.nnum) - 1);
+                if ((sig.nchip == m.nchip) && (((m.nactual ^ m.nexpected) >> sig.nstart) & mask))
+                    sdiff += (sdiff.empty() ? "" : ", ") + sig.sname;
+            }
+            char buf[64];
+            snprintf(buf, sizeof(buf), "0x%X: 0x%X should be 0x%X", m.naddr, m.nactual, m.nexpected);
+            *ctx.perr << vsfiles[m.nchip] << ": " << buf << " (op " << parser.OpName(m.nop);
+            if (!sdiff.empty())
+                *ctx.perr << "; signals: " << sdiff;
+            *ctx.perr << ")" << endl;
+        }
+    }
+    if (nmismatches > 0) {
+        *ctx.perr << "Verify: " << nmismatches << " mismatching word(s)" << endl;
+    } else {
+        silent("Verify: ok, all " << vnchips.size() << " file(s) match the source");
+    }
+    return nmismatches;
+}
+
+
+// 0b... with 'x' for the bits the cube doesn't care about
+static string cube_str(const cube_t& c, int nbits) {
+    string s = "0b";
+    for (int b = nbits - 1; b >= 0; --b)
+        s += ((c.nmask >> b) & 1) ? (char)('0' + ((c.nval >> b) & 1)) : 'x';
+    return s;
+}
+
+
+// value of a signal in the words (0 if there is no such signal)
+static int signal_value(const signals_t *psig, const int *nwords) {
+    if (psig == NULL)
+        return 0;
+    int mask = (psig->nnum >= 32) ? -1 : (int)((1u << psig->nnum) - 1);
+    return (nwords[psig->nchip] >> psig->nstart) & mask;
+}
+
+
+// a changed region of a diff
+typedef struct region {
+    cube_t cube;
+    int nold;           // op in the old source (-1 = defaults)
+    int nnew;           // op in the new source
+} region_t;
+
+
+long long Mcasm::Diff(Mcasm& old, const string& spatch) {
+    LogFlush flush(ctx.plog);
+    if (!pparser || !old.pparser) {
+        error("No source opened");
+        return -1;
+    }
+    const Parser& po = *old.pparser;
+    const Parser& pn = *pparser;
+    int nbits = pn.AddrBits();
+    int naddrmask = (nbits >= 31) ? 0x7FFFFFFF : ((1 << nbits) - 1);
+
+    if (po.AddrBits() != nbits) {
+        error("Different number of input bits (" << po.AddrBits() << " and " << nbits << ")");
+        return -1;
+    }
+
+    // the signals are compared by name, so they can move between the sources
+    vector<string> vsnames;
+    vector<const signals_t*> vpold, vpnew;
+    map<string, size_t> mindex;
+    for (auto& sig : po.Signals()) {
+        mindex[sig.sname] = vsnames.size();
+        vsnames.push_back(sig.sname);
+        vpold.push_back(&sig);
+        vpnew.push_back(NULL);
+    }
+    for (auto& sig : pn.Signals()) {
+        auto it = mindex.find(sig.sname);
+        if (it != mindex.end()) {
+            vpnew[it->second] = &sig;
+            continue;
+        }
+        vsnames.push_back(sig.sname);
+        vpold.push_back(NULL);
+        vpnew.push_back(&sig);
+    }
+
+    // who wins where, in both sources
+    vector<cube_t> vcold, vcnew;
+    vector<int> vnold, vnnew;
+    po.Regions(vcold, vnold);
+    pn.Regions(vcnew, vnnew);
+    silent("Diff: " << vcold.size() << " old and " << vcnew.size() << " new region(s)");
+
+    // all overlapping regions with different signals (checked once for each pair of ops)
+    map<pair<int, int>, string> mchanges;
+    vector<region_t> vregions;
+    for (size_t a = 0; a < vcold.size(); ++a) {
+        for (size_t b = 0; b < vcnew.size(); ++b) {
+            region_t r;
+            if (!cube_intersect(vcold[a], vcnew[b], r.cube))
+                continue;
+            r.nold = vnold[a];
+            r.nnew = vnnew[b];
+            auto key = make_pair(r.nold, r.nnew);
+            auto it = mchanges.find(key);
+            if (it == mchanges.end()) {
+                string sdiff;
+                const int *nwold = po.Words(r.nold);
+                const int *nwnew = pn.Words(r.nnew);
+                for (size_t n = 0; n < vsnames.size(); ++n) {
+                    if (signal_value(vpold[n], nwold) != signal_value(vpnew[n], nwnew))
+                        sdiff += (sdiff.empty() ? "" : ", ") + vsnames[n];
+                }
+                it = mchanges.insert(make_pair(key, sdiff)).first;
+            }
+            if (!it->second.empty())
+                vregions.push_back(r);
+        }
+    }
+    sort(vregions.begin(), vregions.end(), [&](const region_t& x, const region_t& y) {
+        return x.cube.nval < y.cube.nval;
+    });
+
+    // report
+    long long naddrs = 0;
+    for (auto& r : vregions) {
+        long long n = 1ll << (nbits - __builtin_popcount(r.cube.nmask & naddrmask));
+        naddrs += n;
+        *ctx.pout << cube_str(r.cube, nbits) << " (" << n << "): " << po.OpName(r.nold) << " -> "
+                  << pn.OpName(r.nnew) << ": " << mchanges[make_pair(r.nold, r.nnew)] << endl;
+    }
+    *ctx.pout << "Diff: " << vregions.size() << " changed region(s), " << naddrs << " address(es)" << endl;
+
+    // patch: changed addresses and their new words
+    if (!spatch.empty()) {
+        vector<pair<int, int> > vaddrs;     // address, op
+        FILE *pfile;
+        for (auto& r : vregions) {
+            int nfree = ~r.cube.nmask & naddrmask;
+            for (int sub = nfree; ; sub = (sub - 1) & nfree) {
+                vaddrs.push_back(make_pair(r.cube.nval | sub, r.nnew));
+                if (sub == 0)
+                    break;
+            }
+        }
+        sort(vaddrs.begin(), vaddrs.end());
+        if ((pfile = fopen(spatch.c_str(), "w")) == NULL) {
+            error("Can't open file: " << spatch);
+            return -1;
+        }
+        fprintf(pfile, "# mcasm patch: %d address(es)\n# address word(chip 0) word(chip 1) ...\n", (int)vaddrs.size());
+        for (auto& a : vaddrs) {
+            const int *nwords = pn.Words(a.second);
+            fprintf(pfile, "%X", a.first);
+            for (int x = 0; x < pn.Chips(); ++x)
+                fprintf(pfile, " %X", nwords[x]);
+            fputs("\n", pfile);
+        }
+        fclose(pfile);
+        silent("Patch written to: " << spatch);
+    }
+    return naddrs;
+}
+
+
+// names of ops, separated by ", " ("..." if there may be more)
+static string op_names(const Parser& parser, const vector<int>& vnops) {
+    string s;
+    for (auto n : vnops)
+        s += (s.empty() ? "" : ", ") + string(parser.OpName(n));
+    if (vnops.size() >= COVERAGE_SHADOWS)
+        s += ", ...";
+    return s;
+}
+
+
+int Mcasm::Coverage() {
+    LogFlush flush(ctx.plog);
+    if (!pparser) {
+        error("No source opened");
+        return -1;
+    }
+    const Parser& parser = *pparser;
+    coverage_t cov;
+    int nshadowed = 0, nwinning = 0;
+    long long nowned = 0;
+
+    parser.Coverage(cov);
+    for (size_t n = 0; n < cov.vops.size(); ++n) {
+        const opcover_t& op = cov.vops[n];
+        nowned += op.nowned;
+        nwinning += (op.nowned > 0);
+        *ctx.pout << parser.OpName(n) << ": " << op.nowned << " of " << op.nmatched << " address(es)";
+        if ((op.nowned > 0) && (op.nowned < op.nmatched))
+            *ctx.pout << ", overlaps " << op_names(parser, op.vnshadows);
+        *ctx.pout << endl;
+        if (op.nmatched == 0) {
+            warning("Op " << parser.OpName(n) << " matches no address");
+        }
+        else if (op.nowned == 0) {
+            warning("Op " << parser.OpName(n) << " is shadowed by " << op_names(parser, op.vnshadows));
+            ++nshadowed;
+        }
+    }
+    *ctx.pout << "Defaults: " << cov.nuncovered << " address(es) in " << cov.vuncovered.size() << " cube(s)" << endl;
+    for (auto& c : cov.vuncovered)
+        *ctx.pout << "  " << cube_str(c, cov.naddrbits) << endl;
+    *ctx.pout << "Coverage: " << nowned << " of " << (1LL << cov.naddrbits) << " address(es) by "
+              << nwinning << " of " << cov.vops.size() << " op(s), " << nshadowed << " shadowed" << endl;
+    return nshadowed;
+}
+
+
+int Mcasm::Write(const image_t& image, const string& spattern, const string& sformat) {
+    StatsTimer t(ctx.pstats, "output");
+    if (_targets(image, spattern) == -1)
+        return -1;
+    if (sformat == "logisim")
+        return WriteLogisim(image, spattern);
+    if (sformat == "bin")
+        return WriteBinary(image, spattern);
+    if (sformat == "shard")
+        return WriteShard(image, spattern);
+    error("Unknown output format: " << sformat);
+    return -1;
+}
+
+
+// name of the file for chip x
+int Mcasm::_fileName(const string& spattern, int x, string& sfile) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), spattern.c_str(), x);
+    if (n<0) {
+        error("Internal error: mcasm.cpp " << __LINE__);
+        return -1;
+    }
+    sfile = buf;
+    return 1;
+}
+
+
+// names of the files of all chips the image selects (for the depfile)
+int Mcasm::_targets(const image_t& image, const string& spattern) {
+    vstargets.clear();
+    for (int x=0; x < image.nchips; ++x) {
+        if (!image.vbchips.empty() && !image.vbchips[x])
+            continue;
+        string sfile;
+        if (_fileName(spattern, x, sfile) == -1)
+            return -1;
+        vstargets.push_back(sfile);
+    }
+    return 1;
+}
+
+
+// file for chip x, opened for writing
+FILE* Mcasm::_openOutput(const string& spattern, int x, const char *smode) {
+    FILE * pfile;
+    string sfile;
+
+    if (_fileName(spattern, x, sfile) == -1)
+        return NULL;
+
+    silent("File: " << sfile);
+    if ((pfile = fopen(sfile.c_str(), smode)) == NULL) {
+        error("Can't open file: " << sfile);
+        return NULL;
+    }
+    return pfile;
+}
+
+
+// close a file of _openOutput()
+void Mcasm::_closeOutput(FILE *pfile) {
+    if (ctx.pstats) {
+        ctx.pstats->Add("files written", 1);
+        ctx.pstats->Add("bytes written", ftell(pfile));
+    }
+    fclose(pfile);
+}
+
+
+// Logisim v2.0 raw, one word per line (hex)
+int Mcasm::WriteLogisim(const image_t& image, const string& spattern) {
+    silent("Opening target files...");
+    for (int x=0; x < image.nchips; ++x) {
+        if (!image.vbchips.empty() && !image.vbchips[x])
+            continue;
+        TraceSpan span(ctx.ptrace, "output", "write chip");
+        span.Arg("chip", x);
+        FILE * pfile;
+        if ((pfile = _openOutput(spattern, x, "w")) == NULL)
+            return -1;
+        // write header for Logisim format
+        fputs("v2.0 raw\n", pfile);
+        const int *nwords = image.vnwords.data() + (size_t)x * image.nwords;
+        for (int a=0; a < image.nwords; ++a)
+            fprintf(pfile, "%X\n", nwords[a]);
+        _closeOutput(pfile);
+    }
+    return 1;
+}
+
+
+// raw binary, each word with as many bytes as needed (little endian)
+int Mcasm::WriteBinary(const image_t& image, const string& spattern) {
+    int nbytes = (image.nwordbits + 7) / 8;
+
+    silent("Opening target files...");
+    for (int x=0; x < image.nchips; ++x) {
+        if (!image.vbchips.empty() && !image.vbchips[x])
+            continue;
+        TraceSpan span(ctx.ptrace, "output", "write chip");
+        span.Arg("chip", x);
+        FILE * pfile;
+        vector<unsigned char> vbuf;
+        if ((pfile = _openOutput(spattern, x, "wb")) == NULL)
+            return -1;
+        vbuf.reserve((size_t)image.nwords * nbytes);
+        const int *nwords = image.vnwords.data() + (size_t)x * image.nwords;
+        for (int a=0; a < image.nwords; ++a) {
+            for (int b=0; b < nbytes; ++b)
+                vbuf.push_back((unsigned char)(nwords[a] >> (b * 8)));
+        }
+        fwrite(vbuf.data(), 1, vbuf.size(), pfile);
+        _closeOutput(pfile);
+    }
+    return 1;
+}
+
+
+// CRC-32 (IEEE) of the words, each as 4 bytes (little endian)
+static unsigned crc32_words(const int *nwords, size_t ncount) {
+    static const vector<unsigned> vtable = []() {
+        vector<unsigned> v(256);
+        for (unsigned n = 0; n < 256; ++n) {
+            unsigned c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            v[n] = c;
+        }
+        return v;
+    }();
+    unsigned crc = 0xFFFFFFFFu;
+    for (size_t a = 0; a < ncount; ++a) {
+        for (int b = 0; b < 4; ++b)
+            crc = vtable[(crc ^ (unsigned)(nwords[a] >> (b * 8))) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+
+int Mcasm::WriteShard(const image_t& image, const string& spattern) {
+    silent("Opening target files...");
+    for (int x=0; x < image.nchips; ++x) {
+        if (!image.vbchips.empty() && !image.vbchips[x])
+            continue;
+        TraceSpan span(ctx.ptrace, "output", "write chip");
+        span.Arg("chip", x);
+        FILE * pfile;
+        if ((pfile = _openOutput(spattern, x, "w")) == NULL)
+            return -1;
+        const int *nwords = image.vnwords.data() + (size_t)x * image.nwords;
+        fputs("v2.0 raw\n# mcasm shard\n", pfile);
+        fprintf(pfile, "# chip %d of %d\n", x, image.nchips);
+        fprintf(pfile, "# addrbits %d\n", image.naddrbits);
+        fprintf(pfile, "# wordbits %d\n", image.nwordbits);
+        fprintf(pfile, "# range %X %X\n", image.nfirst, image.nfirst + image.nwords - 1);
+        fprintf(pfile, "# source %016llX\n", image.vnsources[x]);
+        fprintf(pfile, "# rom %016llX\n", image.nsource);
+        fprintf(pfile, "# crc32 %08X\n", crc32_words(nwords, image.nwords));
+        for (int a=0; a < image.nwords; ++a)
+            fprintf(pfile, "%X\n", nwords[a]);
+        _closeOutput(pfile);
+    }
+    return 1;
+}
+
+
+// a shard file read back
+typedef struct shard {
+    string sfile;
+    int nchip, nchips;
+    int naddrbits, nwordbits;
+    int nfirst, nlast;
+    unsigned long long nsource;     // hash of the source for this chip
+    unsigned long long nrom;        // hash of the source for all chips
+    unsigned ncrc;
+    vector<int> vnwords;
+} shard_t;
+
+
+// header lines of a shard (each one exactly once)
+enum { SHARD_MAGIC, SHARD_CHIP, SHARD_ADDRBITS, SHARD_WORDBITS, SHARD_RANGE, SHARD_SOURCE, SHARD_ROM, SHARD_CRC, SHARD_FIELDS };
+static const char *shard_fields[SHARD_FIELDS] = {
+    "# mcasm shard", "# chip", "# addrbits", "# wordbits", "# range", "# source", "# rom", "# crc32"
+};
+
+
+// header and words of a shard file
+static int read_shard(const string& sfile, shard_t& sh, string& serr) {
+    MappedFile mf;
+    bool bfound[SHARD_FIELDS] = {false};
+
+    sh.sfile = sfile;
+    if (mf.Open(sfile) == -1) {
+        serr = "can't open file";
+        return -1;
+    }
+    const char *p = mf.data(), *end = p + mf.size();
+    string sline;
+    // header: the comment lines after "v2.0 raw"
+    while (p < end) {
+        const char *e = p;
+        while ((e < end) && (*e != '\n'))
+            ++e;
+        sline.assign(p, e);
+        if (!sline.empty() && (sline.back() == '\r'))
+            sline.pop_back();
+        if ((p != mf.data()) && ((sline.empty()) || (sline[0] != '#')))
+            break;
+        p = (e < end) ? e + 1 : e;
+        if (sline.compare(0, 1, "#") != 0)
+            continue;
+        int f = -1;
+        if (sline == shard_fields[SHARD_MAGIC])
+            f = SHARD_MAGIC;
+        else if (sscanf(sline.c_str(), "# chip %d of %d", &sh.nchip, &sh.nchips) == 2)
+            f = SHARD_CHIP;
+        else if (sscanf(sline.c_str(), "# addrbits %d", &sh.naddrbits) == 1)
+            f = SHARD_ADDRBITS;
+        else if (sscanf(sline.c_str(), "# wordbits %d", &sh.nwordbits) == 1)
+            f = SHARD_WORDBITS;
+        else if (sscanf(sline.c_str(), "# range %X %X", (unsigned*)&sh.nfirst, (unsigned*)&sh.nlast) == 2)
+            f = SHARD_RANGE;
+        else if (sscanf(sline.c_str(), "# source %llX", &sh.nsource) == 1)
+            f = SHARD_SOURCE;
+        else if (sscanf(sline.c_str(), "# rom %llX", &sh.nrom) == 1)
+            f = SHARD_ROM;
+        else if (sscanf(sline.c_str(), "# crc32 %X", &sh.ncrc) == 1)
+            f = SHARD_CRC;
+        if (f < 0)
+            continue;
+        if (bfound[f]) {
+            serr = string("invalid header (more than one '") + shard_fields[f] + "' line)";
+            return -1;
+        }
+        bfound[f] = true;
+    }
+    for (int f = 0; f < SHARD_FIELDS; ++f) {
+        if (!bfound[f]) {
+            serr = string("not a shard (header line '") + shard_fields[f] + "' missing)";
+            return -1;
+        }
+    }
+    if ((sh.naddrbits < 1) || (sh.naddrbits > INPUTS_MAX_BIT + 1) || (sh.nchip < 0) || (sh.nchip >= sh.nchips) ||
+            (sh.nfirst < 0) || (sh.nfirst > sh.nlast) || (sh.nlast > (int)((1LL << sh.naddrbits) - 1))) {
+        serr = "invalid header";
+        return -1;
+    }
+    sh.vnwords.assign((size_t)sh.nlast - sh.nfirst + 1, 0);
+    int nread = parse_logisim(mf.data(), mf.size(), sh.vnwords, serr);
+    if (nread == -1)
+        return -1;
+    if ((size_t)nread != sh.vnwords.size()) {
+        serr = "truncated (" + to_string(nread) + " of " + to_string(sh.vnwords.size()) + " words)";
+        return -1;
+    }
+    if (crc32_words(sh.vnwords.data(), sh.vnwords.size()) != sh.ncrc) {
+        serr = "checksum mismatch";
+        return -1;
+    }
+    return 1;
+}
+
+
+int Mcasm::Merge(const vector<string>& vsshards, image_t& image) {
+    LogFlush flush(ctx.plog);
+    vector<shard_t> vshards(vsshards.size());
+    int nerrors = 0;
+
+    if (vsshards.empty()) {
+        error("No shards given");
+        return -1;
+    }
+    silent("Reading " << vsshards.size() << " shard(s)...");
+    for (size_t n = 0; n < vsshards.size(); ++n) {
+        string serr;
+        if (read_shard(vsshards[n], vshards[n], serr) == -1) {
+            error(vsshards[n] << ": " << serr);
+            return -1;
+        }
+    }
+
+    // all from the same revision of the source (each chip can be generated separately)
+    const shard_t& first = vshards[0];
+    for (auto& sh : vshards) {
+        if ((sh.nchips != first.nchips) || (sh.naddrbits != first.naddrbits) || (sh.nwordbits != first.nwordbits) ||
+                (sh.nrom != first.nrom)) {
+            error(sh.sfile << ": not from the same source as " << first.sfile);
+            return -1;
+        }
+    }
+
+    image.naddrbits = first.naddrbits;
+    image.nchips = first.nchips;
+    image.nfirst = 0;
+    image.nwords = (int)(1LL << first.naddrbits);   // (at most 2^30, see read_shard)
+    image.nwordbits = first.nwordbits;
+    image.vnsources.assign(image.nchips, 0);
+    image.nsource = first.nrom;
+    image.vbchips.assign(image.nchips, false);
+    image.vnwords.assign((size_t)image.nchips * image.nwords, 0);
+    for (int x = 0; x < image.nchips; ++x)
+        image.vbchips[x] = vbchips.empty() || (((size_t)x < vbchips.size()) && vbchips[x]);
+
+    // each chip in address order, without gaps and overlaps
+    sort(vshards.begin(), vshards.end(), [](const shard_t& a, const shard_t& b) {
+        return (a.nchip != b.nchip) ? (a.nchip < b.nchip) : (a.nfirst < b.nfirst);
+    });
+    auto sh = vshards.begin();
+    for (int x = 0; x < image.nchips; ++x) {
+        int nnext = 0;      // first address not covered so far
+        const shard_t *pfirst = NULL;
+        for (; (sh != vshards.end()) && (sh->nchip == x); ++sh) {
+            if (!image.vbchips[x])
+                continue;
+            if (pfirst == NULL)
+                pfirst = &*sh;
+            // (the same chip of the same source)
+            if (sh->nsource != pfirst->nsource) {
+                error("Chip " << x << ": " << sh->sfile << " not from the same source as " << pfirst->sfile);
+                ++nerrors;
+            }
+            if (sh->nfirst > nnext) {
+                error("Chip " << x << ": addresses 0x" << hex << nnext << "..0x" << sh->nfirst - 1 << dec << " missing");
+                ++nerrors;
+            }
+            if (sh->nfirst < nnext) {
+                error("Chip " << x << ": " << sh->sfile << " overlaps 0x" << hex << sh->nfirst << "..0x"
+                      << min(sh->nlast, nnext - 1) << dec << " of another shard");
+                ++nerrors;
+            }
+            copy(sh->vnwords.begin(), sh->vnwords.end(),
+                 image.vnwords.begin() + (size_t)x * image.nwords + sh->nfirst);
+            nnext = max(nnext, sh->nlast + 1);
+        }
+        if (!image.vbchips[x])
+            continue;
+        if (pfirst)
+            image.vnsources[x] = pfirst->nsource;
+        if (nnext < image.nwords) {
+            error("Chip " << x << ": addresses 0x" << hex << nnext << "..0x" << image.nwords - 1 << dec << " missing");
+            ++nerrors;
+        }
+    }
+    if (nerrors)
+        return -1;
+
+    for (int x = 0; x < image.nchips; ++x) {
+        if (!image.vbchips[x])
+            continue;
+        silent("Chip " << x << ": crc32 " << hex << uppercase << setw(8) << setfill('0')
+               << crc32_words(image.vnwords.data() + (size_t)x * image.nwords, image.nwords)
+               << nouppercase << setfill(' ') << dec);
+    }
+    return 1;
+}
+
+
+// escape a file name for use in a makefile rule
+static string make_escape(const string& s) {
+    string r;
+    for (auto c : s) {
+        if ((c == ' ') || (c == '#'))
+            r += '\\';
+        else if (c == '$')
+            r += '$';
+        r += c;
+    }
+    return r;
+}
+
+
+// write all loaded files as prerequisites of all written files (make format)
+int Mcasm::WriteDepfile(const string& sdepfile) {
+    FILE *pfile;
+
+    if ((pfile = fopen(sdepfile.c_str(), "w")) == NULL) {
+        error("Can't open file: " << sdepfile);
+        return -1;
+    }
+    // targets : prerequisites
+    for (auto t : vstargets)
+        fprintf(pfile, "%s ", make_escape(t).c_str());
+    fputs(":", pfile);
+    for (auto f : ctx.vfiles)
+        fprintf(pfile, " \\\n %s", make_escape(f).c_str());
+    fputs("\n", pfile);
+    // phony targets, so make doesn't fail if a file gets removed
+    for (size_t x = 1; x < ctx.vfiles.size(); ++x)
+        fprintf(pfile, "\n%s:\n", make_escape(ctx.vfiles[x]).c_str());
+    fclose(pfile);
+
+    if (!ctx.cfg.s)
+        *ctx.pout << "Dependencies written to: " << sdepfile << endl;
+    return 1;
+}
@@ -0,0 +1,181 @@
+/*
+ *
+ *    mcasm.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MCASM_H_
+#define MCASM_H_
+
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "loader.h"
+#include "log.h"
+#include "parser.h"
+#include "stats.h"
+#include "trace.h"
+
+
+using namespace std;
+
+
+// a variant: the same source with other values for some definitions
+typedef struct variant {
+    string sname;                       // name (used for the file names)
+    map<string, long long> moverrides;  // definition -> value
+    int nstatus;                        // -1 error, 1 ok (after CompileVariants)
+    string slog;                        // messages and errors of the variant
+    image_t image;                      // result
+} variant_t;
+
+
+// what generating (and writing) the ROM will cost, from a quick calibration
+typedef struct estimate {
+    long long naddrs;       // addresses generated (each chip)
+    int nchips;             // chips generated and written
+    long long nmembytes;    // size of the image(s) in memory
+    long long noutbytes;    // size of the files (in the format of SetFormat)
+    double dseconds;        // expected time to generate and write (one thread)
+} estimate_t;
+
+
+// estimates bigger than this are refused (see config_t::nmaxbytes)
+#define DEFAULT_LIMIT (2LL << 30)
+
+// addresses tried by the calibration of the estimate
+#define ESTIMATE_SAMPLES 4096
+
+
+/*
+ * library interface, everything needed for one compile lives in the object
+ *  (one object per thread, or one after the other)
+ *
+ *  Mcasm mc;
+ *  mc.Config().s = true;
+ *  mc.SetFile("test.mc", "#inputs {\n...");
+ *  if (mc.Compile("test.mc", image) == 1)
+ *      ... image.vnwords[chip * image.nwords + address] ...
+ */
+class Mcasm
+{
+    context_t ctx;
+    Log log;                    // messages of ctx (after ctx)
+    map<string, string> mfiles; // in-memory files
+    readfile_t readfile;        // callback for all other files (empty = from disk)
+    vector<string> vstargets;   // output files of all selected chips (depfile targets, even if not written again)
+    map<string, long long> mdefines;    // overridden definitions (-D)
+    unique_ptr<Parser> pparser; // parsed source for Lookup()
+    int nfirst, nlast;          // address range to generate (nlast -1 = up to the end)
+    vector<bool> vbchips;       // chips to generate, verify and write (empty = all)
+    bool breference;            // generate with the naive loop
+    string sformat;             // output format assumed by the estimate
+    // watch mode (Update)
+    unique_ptr<Parser> pwatch;  // parsed source of the last update (ops kept)
+    image_t watchimage;         // its ROM image
+    map<string, string> mwatchfiles;    // its files, only the changed ones are read again
+    unique_ptr<LineCache> pwatchcache;  // cleaned lines of its files (if no cache is set)
+    bool bwatchfiles;           // _readFile() takes and keeps the files in mwatchfiles
+
+    int _readFile(const string& sname, string& sdata);
+    int _load(const string& sfile);
+    int _fileName(const string& spattern, int x, string& sfile);
+    int _targets(const image_t& image, const string& spattern);
+    FILE* _openOutput(const string& spattern, int x, const char *smode);
+    void _closeOutput(FILE *pfile);
+    void _estimate(const Parser& parser, int ncopies, estimate_t& est);
+    int _preflight(const Parser& parser, int ncopies);
+
+public:
+    Mcasm();
+    Mcasm(const Mcasm&) = delete;
+    Mcasm& operator=(const Mcasm&) = delete;
+
+    // options, messages and where the files come from
+    config_t& Config() { return ctx.cfg; }
+    int LogLevel(int nsub) const { return log.Level(nsub); }
+    Log& Messages() { return log; }
+    void SetOutput(ostream *pout, ostream *perr);
+    void SetFile(const string& sname, const string& sdata);
+    void ClearFiles();
+    void SetReadFile(readfile_t callback);
+    void SetCache(LineCache *pcache);
+    void SetStats(Stats *pstats);
+    void SetTrace(Trace *ptrace);
+    void Define(const string& sname, long long nval);
+    // generate only the addresses nfirst..nlast (a shard, see WriteShard)
+    void SetRange(int nfirst, int nlast);
+    // work on these chips only, the files of the others are not touched
+    void SelectChips(const vector<int>& vnchips);
+    // generate with the naive loop over all cubes (slow, the reference for tests)
+    void SetReference(bool breference);
+    // output format the estimate assumes (Write() still gets it)
+    void SetFormat(const string& sformat);
+
+    // load, parse and generate the ROM contents (no file is written)
+    int Compile(const string& sfile, image_t& image);
+    // the same for each variant, the source is parsed only once
+    //  returns the number of failed variants (-1 if the source itself has errors)
+    int CompileVariants(const string& sfile, vector<variant_t>& vvariants);
+
+    // watch mode: Compile() and Write() again after the files vschanged were modified
+    //  (the first time everything), the image of the last update is kept: only changed
+    //  #op blocks are parsed again, only the addresses of changed ops are generated
+    //  and only chips with changed words are written
+    int Update(const string& sfile, const vector<string>& vschanged, const string& spattern, const string& sformat);
+
+    // load and parse only, what Compile() would cost (nothing is generated)
+    int Estimate(const string& sfile, estimate_t& est);
+
+    // load and parse only, then ask for single addresses
+    int Open(const string& sfile);
+    int Lookup(long long naddr, lookup_t& res);
+    // compare existing chip files (Logisim raw or binary) with the opened source
+    //  prints the first nmaxerrors mismatches, returns the number of mismatches
+    int Verify(const string& spattern, int nmaxerrors);
+    // changed address regions from the source opened by old to the one opened here
+    //  spatch (optional) gets the changed addresses with their new words
+    //  returns the number of changed addresses
+    long long Diff(Mcasm& old, const string& spatch);
+    // addresses won by each op of the opened source, shadowed ops (warnings) and
+    //  what is left to the defaults, returns the number of shadowed ops
+    int Coverage();
+
+    // files loaded by the last Compile() (source and includes)
+    const vector<string>& Files() const { return ctx.vfiles; }
+
+    // output (one file for each chip, spattern contains %d for the chip)
+    int Write(const image_t& image, const string& spattern, const string& sformat);
+    int WriteLogisim(const image_t& image, const string& spattern);
+    int WriteBinary(const image_t& image, const string& spattern);
+    // a range of the ROM: Logisim v2.0 raw with a header ('#' comments) giving the
+    //  chip, the sizes, the address range, the source hashes (of the chip and of all
+    //  chips) and the CRC-32 of the words
+    int WriteShard(const image_t& image, const string& spattern);
+    // the whole ROM again from the shards of all chips (any order), checks that they
+    //  are intact, come from the same source and cover each (selected) chip without overlaps
+    int Merge(const vector<string>& vsshards, image_t& image);
+    int WriteDepfile(const string& sdepfile);
+};
+
+
+#endif /* MCASM_H_ */
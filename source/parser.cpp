@@ -18,174 +18,281 @@
  *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
-#include <sstream>
+#include <thread>
 #include <vector>
 
-#include "Parser.h"
+#include "parser.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
 
-#define debug_gen(out)  if (g_cfg.d || g_cfg.d_flags.g) { cout << out << endl; }
-#define silent_gen(out) if (!g_cfg.s || g_cfg.d || g_cfg.d_flags.g) { cout << out << endl; }
 // some message macros
-#define debug(out)  if (g_cfg.d || g_cfg.d_flags.p) { cout << out << endl; }
-#define silent(out) if (!g_cfg.s || g_cfg.d || g_cfg.d_flags.p) { cout << out << endl; }
-#define error(out) { cerr << "ERROR: "<< out << endl; }
-#define parse_error(msg) { cerr \
-    << g_vfiles.at(cur_line->file_id) << ":" << cur_line->nline << ": error: " << msg << endl \
-    << "~~~> " << cur_line->sline << endl; }
-string spaces = "                                                                                ";
-#define parse_error_pos(pos, msg) { parse_error(msg) \
-    cerr << "     " << spaces.substr(0, pos) << "^" << endl; }
+#define trace_gen(out)  log_msg(LOG_GENERATOR, LOG_TRACE, out)
+#define debug_gen(out)  log_msg(LOG_GENERATOR, LOG_DEBUG, out)
+#define silent_gen(out) log_msg(LOG_GENERATOR, LOG_INFO, out)
+#define debug(out)  log_msg(LOG_PARSER, LOG_DEBUG, out)
+#define silent(out) log_msg(LOG_PARSER, LOG_INFO, out)
+#define error(out)  log_msg(LOG_PARSER, LOG_ERROR, "ERROR: " << out)
+// (muted while ops are parsed in parallel, the first failing op gets parsed again)
+#define parse_error(msg) if (!bquiet) { log_msg(LOG_PARSER, LOG_ERROR, \
+    ctx.vfiles.at(cur_line->file_id) << ":" << cur_line->nline << ": error: " << msg << '\n' \
+    << "~~~> " << cur_line->sline) }
+#define parse_error_pos(pos, msg) if (!bquiet) { log_msg(LOG_PARSER, LOG_ERROR, \
+    ctx.vfiles.at(cur_line->file_id) << ":" << cur_line->nline << ": error: " << msg << '\n' \
+    << "~~~> " << cur_line->sline << '\n' \
+    << "     " << string(pos, ' ') << "^") }
+
+
+// bit mask with the lowest n bits set
+static inline int bitmask(int n) {
+    return (n >= 32) ? -1 : (int)((1u << n) - 1);
+}
+
 
+Parser::Parser(context_t& context) : ctx(context) {
+    signals_nchips = 0;
+    signals_nbits = 0;
+    inputs_nbits = 0;
+    bquiet = false;
+    memset(&optable, 0, sizeof(optable));
+    poverrides = NULL;
+    pbase = NULL;
+    pprev = NULL;
+    bsameprev = false;
+    bkeepops = false;
+    breference = false;
+    nreparsed = 0;
+    nlookups = 0;
+}
 
-vector<string> split(const string &s, char delim) {
-    vector<string> result;
-    stringstream ss (s);
-    string item;
 
-    while (getline(ss, item, delim)) {
-        result.push_back(item);
-    }
+// values of definitions to use instead of the ones in the source
+void Parser::SetOverrides(const map<string, long long> *poverrides) {
+    this->poverrides = poverrides;
+}
+
+
+// parse a variant of an already parsed source (the same lines, other overrides)
+//  only ops depending on changed definitions are parsed again
+void Parser::SetBase(const Parser *pbase) {
+    this->pbase = pbase;
+}
+
+
+// watch mode: parse the next version of a source (same overrides and chips), if only
+//  #op blocks have changed the unchanged ones are taken from pprev (parsed with KeepOps)
+void Parser::SetPrevious(const Parser *pprev) {
+    this->pprev = pprev;
+}
+
+
+// keep the parsed ops, needed if the parser is the base of variants or of the next
+//  version of the source (watch mode)
+void Parser::KeepOps() {
+    bkeepops = true;
+}
+
 
-    return result;
+// generate with the naive loop (the reference the faster ways are checked against)
+void Parser::SetReference(bool breference) {
+    this->breference = breference;
 }
 
 
-string cout_int2bin(int bnum, int len = sizeof(int)*8) {
-    cout << "0b";
-    for (int i = len-1; i >= 0; --i) {
-        cout << ((bnum >> i) & 1);
+// generate only some chips (vbchips[x]), the signals of the others are skipped
+void Parser::SelectChips(const vector<bool>& vbchips) {
+    this->vbchips = vbchips;
+}
+
+
+// patch that changes nothing
+static void patch_init(patch_t& patch, int nchips) {
+    patch.vnand.assign(nchips, -1);
+    patch.vnor.assign(nchips, 0);
+}
+
+
+// apply (and, or) to one chip of the patch
+static inline void patch_apply(patch_t& patch, int nchip, int nand, int nor) {
+    patch.vnand[nchip] &= nand;
+    patch.vnor[nchip] = (patch.vnor[nchip] & nand) | nor;
+}
+
+
+// sort the list of used definitions and remove duplicates
+static void deps_unique(vector<size_t>& vdeps) {
+    sort(vdeps.begin(), vdeps.end());
+    vdeps.erase(unique(vdeps.begin(), vdeps.end()), vdeps.end());
+}
+
+
+// apply all chips of another patch (e.g. a macro)
+static void patch_merge(patch_t& patch, const patch_t& other) {
+    size_t n = min(patch.vnand.size(), other.vnand.size());
+    for (size_t x = 0; x < n; ++x)
+        patch_apply(patch, x, other.vnand[x], other.vnor[x]);
+}
+
+
+// interns the identifier and returns its symbol table entry
+syms_t& Parser::_addSymbol(const string& str) {
+    int id = symbols.Intern(str);
+    if ((size_t)id >= vsyms.size()) {
+        syms_t empty = {string::npos, string::npos, string::npos, string::npos};
+        vsyms.resize(id + 1, empty);
     }
-    return "";
+    return vsyms[id];
 }
 
 
-size_t Parser::_findSignal(const string& str) {
-	for (size_t x = 0; x < vsignals.size(); ++x) {
-		if (vsignals[x].sname == str)
-			return x;
-	}
-	return string::npos;
+// source position of a span
+static void trace_line(TraceSpan& span, const context_t& ctx, const mcLines& line) {
+    if (span.On()) {
+        span.Arg("file", ctx.vfiles[line.file_id]);
+        span.Arg("line", line.nline);
+    }
 }
 
 
-size_t Parser::_findDefine(const string& str) {
-	for (size_t x = 0; x < vdefs.size(); ++x) {
-		if (vdefs[x].sname == str)
-			return x;
-	}
-	return string::npos;
+// symbol lookups of this thread not yet added to nlookups (--stats)
+static thread_local long long nthreadlookups = 0;
+
+
+const syms_t* Parser::_findSymbol(const token_t& tok) {
+    ++nthreadlookups;
+    int id = symbols.Find(tok.p, tok.len);
+    if ((id < 0) || ((size_t)id >= vsyms.size()))
+        return NULL;
+    return &vsyms[id];
 }
 
 
-size_t Parser::_findMacro(const string& str) {
-	for (size_t x = 0; x < vmacros.size(); ++x) {
-		if (vmacros[x].sname == str)
-			return x;
-	}
-	return string::npos;
+size_t Parser::_findSignal(const token_t& tok) {
+    const syms_t *sym = _findSymbol(tok);
+    return sym ? sym->nsignal : string::npos;
 }
 
 
-int Parser::_parseNum(size_t pos, size_t *next) {
-    size_t p1, p2;
-    int num;
+size_t Parser::_findDefine(const token_t& tok) {
+    const syms_t *sym = _findSymbol(tok);
+    return sym ? sym->ndefine : string::npos;
+}
+
+
+size_t Parser::_findMacro(const token_t& tok) {
+    const syms_t *sym = _findSymbol(tok);
+    return sym ? sym->nmacro : string::npos;
+}
+
 
-    p1 = cur_line->sline.find_first_not_of(" ", pos);
-    p2 = cur_line->sline.find_first_of("0123456789", pos);
-    if ((p1 == string::npos) || (p1 != p2)) {
-        *next = string::npos;
+// reached the end of the source inside of a block
+int Parser::_unterminated() {
+    --cur_line;
+    parse_error("End of block '}' expected!");
+    return -1;
+}
+
+
+// next token must be a numeric value
+int Parser::_parseNum(Lexer& lex, long long *val, const char *msg) {
+    token_t tok = lex.Next();
+
+    if (tok.type == TOK_ERROR) {
+        parse_error_pos(tok.pos, "Malformed numeric value!");
         return -1;
     }
-
-    num = stoi(cur_line->sline.substr(p1), &p2);
-    *next = pos + p2;
-    return num;
+    if (tok.type != TOK_NUMBER) {
+        parse_error_pos(tok.pos, msg);
+        return -1;
+    }
+    *val = tok.nval;
+    return 1;
 }
 
 
-size_t Parser::_parseDelim(size_t pos, const char *delim) {
-    size_t p1, p2;
+// next token must be the given delimiter
+int Parser::_parseDelim(Lexer& lex, const char *delim) {
+    if (!lex.Accept(delim)) {
+        parse_error_pos(lex.Peek().pos, "Delimiter character '" << delim << "' expected!");
+        return -1;
+    }
+    return 1;
+}
+
 
-    p1 = cur_line->sline.find_first_not_of(" ", pos);
-    p2 = cur_line->sline.find_first_of(delim, pos);
-    if ((p1 == string::npos) || (p2 == string::npos) || (p1 != p2))
-        return string::npos;
-    
-    p1 = cur_line->sline.find_first_not_of(delim, p2);
-    if (p1 == string::npos)
-        return cur_line->sline.size();
-    
-    return p1;
+// next token must be an identifier
+int Parser::_parseName(Lexer& lex, token_t *tok, const char *msg) {
+    *tok = lex.Next();
+    if ((tok->type != TOK_IDENT) && (tok->type != TOK_DONTCARE)) {
+        parse_error_pos(tok->pos, msg);
+        return -1;
+    }
+    return 1;
 }
 
 
-string Parser::_parseName(size_t pos, size_t *next) {
-    size_t p1, p2;
+// bit or bit..bit (in any order)
+int Parser::_parseBits(Lexer& lex, int *nstart, int *nend, int nmax, const char *swhy) {
+    long long a, b;
+    size_t pos = lex.Peek().pos;
 
-    p1 = cur_line->sline.find_first_not_of(" ", pos);
-    p2 = cur_line->sline.find_first_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", pos);
-    if ((p1 == string::npos) || (p2 == string::npos) || (p1 != p2)) {
-        *next = string::npos;
-        return "";
+    if (_parseNum(lex, &a, "Numeric value (bit position).. expected!") == -1)
+        return -1;
+    b = a;
+    // multi-bit?
+    if (lex.Accept("..")) {
+        pos = lex.Peek().pos;
+        if (_parseNum(lex, &b, "Numeric value (bit position).. expected!") == -1)
+            return -1;
+    }
+    if ((a > nmax) || (b > nmax)) {
+        parse_error_pos(pos, "Bit position out of range (0.." << nmax << ")!" << swhy);
+        return -1;
     }
-    p2 = cur_line->sline.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", p1);
-    *next = p2;
-    if (p2 == string::npos)
-        return cur_line->sline.substr(p1);
-    else
-        return cur_line->sline.substr(p1, p2 - p1);
+    *nstart = (int)min(a, b);
+    *nend   = (int)max(a, b);
+    return 1;
 }
 
 
 // #input { }
 int Parser::ParseInputs() {
-    for (++cur_line; cur_line != g_vlines.end(); ++cur_line) {
-        size_t p1, p2;
+    for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+        Lexer lex(cur_line->sline);
         inputs_t new_inputs = {0, 0, 0, ""};
-        int a, b;
+        token_t tok;
 
-        if (cur_line->sline.find("}", 0) != string::npos) {
+        if (lex.Is("}")) {
             return 1;
         }
-        // bit or start-bit
-        a = b = _parseNum(0, &p1);
-        if (p1 == string::npos) {
-            parse_error_pos(0, "Numeric value (bit position).. expected!");
+        // bit or start-bit..end-bit (the generator counts addresses in an int)
+        if (_parseBits(lex, &new_inputs.nstart, &new_inputs.nend, INPUTS_MAX_BIT,
+                       " At most 2^30 addresses are supported.") == -1)
             return -1;
-        }
-        // multi-bit?
-        if ((p2 = _parseDelim(p1, ".")) != string::npos) {
-            b = _parseNum(p2, &p1);
-            if (p1 == string::npos) {
-                parse_error_pos(p2, "Numeric value (bit position).. expected!");
-                return -1;
-            }
-            new_inputs.nstart = min(a, b);
-            new_inputs.nend   = max(a, b);
-            new_inputs.nnum = 1 + new_inputs.nend - new_inputs.nstart;
-        }
-        // single-bit!
-        else {
-            new_inputs.nstart = a;
-            new_inputs.nend = new_inputs.nstart;
-            new_inputs.nnum = 1;
-        }
-        inputs_nbits = max(max(a, b), inputs_nbits);
+        new_inputs.nnum = 1 + new_inputs.nend - new_inputs.nstart;
+        inputs_nbits = max(new_inputs.nend, inputs_nbits);
         // identifier
-        if ((p2 = _parseDelim(p1, "=")) == string::npos) {
-            parse_error_pos(p1, "Delimiter character '=' expected!");
+        if (_parseDelim(lex, "=") == -1)
             return -1;
-        }
-        new_inputs.sname = _parseName(p2, &p1);
-        if (new_inputs.sname.empty()) {
-            parse_error_pos(p2, "Identifier (name of input) expected!");
+        if (_parseName(lex, &tok, "Identifier (name of input) expected!") == -1)
+            return -1;
+        new_inputs.sname.assign(tok.p, tok.len);
+        syms_t& sym = _addSymbol(new_inputs.sname);
+        if (sym.ninput != string::npos) {
+            parse_error_pos(tok.pos, "Input already defined!");
             return -1;
         }
 
         // insert in list
+        sym.ninput = vinputs.size();
         vinputs.push_back(new_inputs);
 
         // debug info
@@ -195,69 +302,53 @@ int Parser::ParseInputs() {
             debug("New input: single bit id:" << new_inputs.sname << " bit:" << new_inputs.nstart);
         }
     }
-    return 1;
+    return _unterminated();
 }
 
 
 // #signals { }
 int Parser::ParseSignals() {
-    for (++cur_line; cur_line != g_vlines.end(); ++cur_line) {
-        size_t p1, p2;
+    for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+        Lexer lex(cur_line->sline);
         signals_t new_signal = {0, 0, 0, 0, "", 0};
-        int a, b;
+        token_t tok;
+        long long nchip;
 
-        if (cur_line->sline.find("}", 0) != string::npos) {
+        if (lex.Is("}")) {
             return 1;
         }
 
         // chip
-        new_signal.nchip = _parseNum(0, &p1);
-        signals_nchips = max(signals_nchips, new_signal.nchip);
-        if (p1 == string::npos) {
-            parse_error_pos(0, "Numeric value (chip/byte number) expected!");
+        if (_parseNum(lex, &nchip, "Numeric value (chip/byte number) expected!") == -1)
             return -1;
-        }
+        new_signal.nchip = (int)nchip;
+        signals_nchips = max(signals_nchips, new_signal.nchip);
         // delim
-        if ((p2 = _parseDelim(p1, ":")) == string::npos) {
-            parse_error_pos(p1, "Delimiter character ':' expected!");
+        if (_parseDelim(lex, ":") == -1)
             return -1;
-        }
-        // bit or start-bit
-        a = b = _parseNum(p2, &p1);
-        if (p1 == string::npos) {
-            parse_error_pos(0, "Numeric value (bit position).. expected!");
+        // bit or start-bit..end-bit
+        if (_parseBits(lex, &new_signal.nstart, &new_signal.nend, 31) == -1)
             return -1;
-        }
-        // multi-bit?
-        if ((p2 = _parseDelim(p1, ".")) != string::npos) {
-            b = _parseNum(p2, &p1);
-            if (p1 == string::npos) {
-                parse_error_pos(p2, "Numeric value (bit position).. expected!");
-                return -1;
-            }
-            new_signal.nstart = min(a, b);
-            new_signal.nend   = max(a, b);
-            new_signal.nnum = 1 + new_signal.nend - new_signal.nstart;
-        }
-        // single-bit!
-        else {
-            new_signal.nstart = a;
-            new_signal.nend = new_signal.nstart;
-            new_signal.nnum = 1;
-        }
-        signals_nbits = max(max(a, b), signals_nbits);
+        new_signal.nnum = 1 + new_signal.nend - new_signal.nstart;
+        signals_nbits = max(new_signal.nend, signals_nbits);
         // identifier
-        if ((p2 = _parseDelim(p1, "=")) == string::npos) {
-            parse_error_pos(p1, "Delimiter character '=' expected!");
+        if (_parseDelim(lex, "=") == -1)
+            return -1;
+        if (_parseName(lex, &tok, "Identifier (name of signal) expected!") == -1)
+            return -1;
+        new_signal.sname.assign(tok.p, tok.len);
+        syms_t& sym = _addSymbol(new_signal.sname);
+        if (sym.nsignal != string::npos) {
+            parse_error_pos(tok.pos, "Signal already defined!");
             return -1;
         }
-        new_signal.sname = _parseName(p2, &p1);
-        if (new_signal.sname.empty()) {
-            parse_error_pos(p2, "Identifier (name of signal) expected!");
+        if (sym.nmacro != string::npos) {
+            parse_error_pos(tok.pos, "Identifier already defined as macro!");
             return -1;
         }
 
         // insert in list
+        sym.nsignal = vsignals.size();
         vsignals.push_back(new_signal);
 
         // debug info
@@ -267,293 +358,844 @@ int Parser::ParseSignals() {
             debug("New signal: single bit id:" << new_signal.sname << " chip:" << new_signal.nchip << " bit:" << new_signal.nstart);
         }
     }
+    return _unterminated();
+}
+
+
+// binary operators of constant expressions, higher binds stronger (-1 = none)
+static int binop_prec(const token_t& tok) {
+    if (tok.type == TOK_ALL)
+        return 6;
+    if (tok.type != TOK_PUNCT)
+        return -1;
+    if (tok_equals(tok, "/") || tok_equals(tok, "%"))
+        return 6;
+    if (tok_equals(tok, "+") || tok_equals(tok, "-"))
+        return 5;
+    if (tok_equals(tok, "<<") || tok_equals(tok, ">>"))
+        return 4;
+    if (tok_equals(tok, "&"))
+        return 3;
+    if (tok_equals(tok, "^"))
+        return 2;
+    if (tok_equals(tok, "|"))
+        return 1;
+    return -1;
+}
+
+
+// constant expression (64 bit): numbers, definitions, width(input/signal),
+//  ( ), unary - ~, binary * / % + - << >> & ^ | (C precedence)
+//  and the parameters of the macro being expanded
+int Parser::_evalExpr(Lexer& lex, const scope_t& scope, long long *val) {
+    return _evalBinary(lex, scope, 1, val);
+}
+
+
+int Parser::_evalBinary(Lexer& lex, const scope_t& scope, int nprec, long long *val) {
+    if (_evalUnary(lex, scope, val) == -1)
+        return -1;
+    while (binop_prec(lex.Peek()) >= nprec) {
+        token_t op = lex.Next();
+        long long rhs;
+        // left associative: the right side only takes stronger operators
+        if (_evalBinary(lex, scope, binop_prec(op) + 1, &rhs) == -1)
+            return -1;
+        // (an overflow is an error, the bits of a shift are just shifted out)
+        bool boverflow = false;
+        if (op.type == TOK_ALL)
+            boverflow = __builtin_mul_overflow(*val, rhs, val);
+        else if (tok_equals(op, "/") || tok_equals(op, "%")) {
+            if (rhs == 0) {
+                parse_error_pos(op.pos, "Division by zero!");
+                return -1;
+            }
+            if ((rhs == -1) && (*val == LLONG_MIN))
+                boverflow = true;
+            else
+                *val = tok_equals(op, "/") ? *val / rhs : *val % rhs;
+        }
+        else if (tok_equals(op, "+"))
+            boverflow = __builtin_add_overflow(*val, rhs, val);
+        else if (tok_equals(op, "-"))
+            boverflow = __builtin_sub_overflow(*val, rhs, val);
+        else if (tok_equals(op, "<<") || tok_equals(op, ">>")) {
+            if ((rhs < 0) || (rhs > 63)) {
+                parse_error_pos(op.pos, "Shift count out of range (0..63)!");
+                return -1;
+            }
+            *val = tok_equals(op, "<<") ? (long long)((unsigned long long)*val << rhs) : (*val >> rhs);
+        }
+        else if (tok_equals(op, "&"))
+            *val &= rhs;
+        else if (tok_equals(op, "^"))
+            *val ^= rhs;
+        else
+            *val |= rhs;
+        if (boverflow) {
+            parse_error_pos(op.pos, "Overflow in constant expression!");
+            return -1;
+        }
+    }
     return 1;
 }
 
 
+int Parser::_evalUnary(Lexer& lex, const scope_t& scope, long long *val) {
+    token_t tok = lex.Next();
+
+    switch (tok.type) {
+        case TOK_NUMBER:
+            *val = tok.nval;
+            return 1;
+        case TOK_ERROR:
+            parse_error_pos(tok.pos, "Malformed numeric value!");
+            return -1;
+        case TOK_IDENT: {
+            // width of an input or signal
+            if (tok_equals(tok, "width") && lex.Is("(")) {
+                token_t ntok;
+                const syms_t *sym;
+                lex.Next();
+                if (_parseName(lex, &ntok, "Identifier (of input or signal) expected!") == -1)
+                    return -1;
+                if ((sym = _findSymbol(ntok)) && (sym->ninput != string::npos))
+                    *val = vinputs[sym->ninput].nnum;
+                else if (sym && (sym->nsignal != string::npos))
+                    *val = vsignals[sym->nsignal].nnum;
+                else {
+                    parse_error_pos(ntok.pos, "Input or signal '" << string(ntok.p, ntok.len) << "' not defined!");
+                    return -1;
+                }
+                return _parseDelim(lex, ")");
+            }
+            // parameter of the macro
+            if (scope.pmacro) {
+                for (size_t n = 0; n < scope.pmacro->vsparams.size(); ++n) {
+                    if (tok_equals(tok, scope.pmacro->vsparams[n].c_str())) {
+                        *val = scope.nargs[n];
+                        return 1;
+                    }
+                }
+            }
+            // definition (already evaluated)
+            size_t ndef = _findDefine(tok);
+            if (ndef >= scope.ndefs) {
+                parse_error_pos(tok.pos, "Definition '" << string(tok.p, tok.len) << "' not defined!");
+                return -1;
+            }
+            if (vdefs[ndef].ntype != TOK_NUMBER) {
+                parse_error_pos(tok.pos, "Definition '" << vdefs[ndef].sname << "' is not a value!");
+                return -1;
+            }
+            *val = vdefs[ndef].nval;
+            if (scope.pdeps)
+                scope.pdeps->push_back(ndef);
+            return 1;
+        }
+        case TOK_PUNCT:
+            if (tok_equals(tok, "(")) {
+                if (_evalExpr(lex, scope, val) == -1)
+                    return -1;
+                return _parseDelim(lex, ")");
+            }
+            if (tok_equals(tok, "-") || tok_equals(tok, "~") || tok_equals(tok, "+")) {
+                if (_evalUnary(lex, scope, val) == -1)
+                    return -1;
+                if (tok_equals(tok, "-") && (*val == LLONG_MIN)) {
+                    parse_error_pos(tok.pos, "Overflow in constant expression!");
+                    return -1;
+                }
+                if (tok_equals(tok, "-"))
+                    *val = -*val;
+                else if (tok_equals(tok, "~"))
+                    *val = ~*val;
+                return 1;
+            }
+            break;
+    }
+    parse_error_pos(tok.pos, "Numeric value or expression expected!");
+    return -1;
+}
+
+
 // #define xyz (xyz)
 int Parser::ParseDefines() {
-    size_t p1, p2, p3;
-    defs_t new_def = {"", ""};
+    Lexer lex(cur_line->sline, 7);
+    defs_t new_def = {"", "", TOK_NUMBER, 0};
+    token_t tok;
+    size_t p1;
 
     // Identifier
-    new_def.sname = _parseName(7, &p1);
-    if (new_def.sname.empty()) {
-        parse_error_pos(7, "Identifier (of definition) expected!");
+    if (_parseName(lex, &tok, "Identifier (of definition) expected!") == -1)
+        return -1;
+    new_def.sname.assign(tok.p, tok.len);
+    syms_t& sym = _addSymbol(new_def.sname);
+    if (sym.ndefine != string::npos) {
+        parse_error_pos(tok.pos, "Definition already defined!");
         return -1;
     }
-    if ((p2 = cur_line->sline.find_first_of("(", p1)) == string::npos) {
-        parse_error_pos(p1, "Begin of replacement '(' expected!");
+    // replacement
+    p1 = lex.Peek().pos + 1;
+    if (!lex.Accept("(")) {
+        parse_error_pos(lex.Peek().pos, "Begin of replacement '(' expected!");
         return -1;
     }
-    ++p2;
-    if ((p3 = cur_line->sline.substr(p2).find_last_of(")")) == string::npos) {
-        parse_error_pos(cur_line->sline.size(), "End of replacement ')' expected!");
+    // 'x' or '*' (ignored inputs)
+    Lexer la = lex;
+    la.Next();
+    if (((lex.Peek().type == TOK_DONTCARE) || (lex.Peek().type == TOK_ALL)) && la.Is(")")) {
+        new_def.ntype = lex.Next().type;
+    }
+    // constant expression, evaluated only once
+    else {
+        scope_t scope = {vdefs.size(), 0, NULL, NULL, NULL};
+        if (_evalExpr(lex, scope, &new_def.nval) == -1)
+            return -1;
+    }
+    // value given on the command line (-D)
+    if (poverrides) {
+        auto it = poverrides->find(new_def.sname);
+        if (it != poverrides->end()) {
+            if (new_def.ntype != TOK_NUMBER) {
+                parse_error_pos(tok.pos, "Definition '" << new_def.sname << "' is not a value, can't override it!");
+                return -1;
+            }
+            new_def.nval = it->second;
+        }
+    }
+    if (!lex.Is(")")) {
+        parse_error_pos(lex.Peek().pos, "End of replacement ')' expected!");
         return -1;
     }
-    new_def.scontent = cur_line->sline.substr(p2, p3);
-    
+    new_def.scontent = cur_line->sline.substr(p1, lex.Peek().pos - p1);
+    lex.Next();
+    if (lex.Peek().type != TOK_END) {
+        parse_error_pos(lex.Peek().pos, "End of line expected!");
+        return -1;
+    }
+
     // add to list
+    sym.ndefine = vdefs.size();
     vdefs.push_back(new_def);
 
     // debug info
-    debug("New definition: id:" << new_def.sname << " rep:\"" << new_def.scontent << "\"");
+    if (new_def.ntype == TOK_NUMBER) {
+        debug("New definition: id:" << new_def.sname << " rep:\"" << new_def.scontent << "\" = " << new_def.nval);
+    } else {
+        debug("New definition: id:" << new_def.sname << " rep:\"" << new_def.scontent << "\"");
+    }
 
     return 1;
 }
 
 
 // #define xyz { ... }
+// #define xyz(param, ...) { ... }
 int Parser::ParseMacros() {
-    size_t p1, p2;
-    macros_t new_macro = {"", ""};
+    Lexer lex(cur_line->sline, 7);
+    macros_t new_macro;
+    token_t tok;
 
     // Identifier
-    new_macro.sname = _parseName(7, &p1);
-    if (new_macro.sname.empty()) {
-        parse_error_pos(7, "Identifier (of macro) expected!");
+    if (_parseName(lex, &tok, "Identifier (of macro) expected!") == -1)
+        return -1;
+    new_macro.sname.assign(tok.p, tok.len);
+    syms_t& sym = _addSymbol(new_macro.sname);
+    if (sym.nmacro != string::npos) {
+        parse_error_pos(tok.pos, "Macro already defined!");
+        return -1;
+    }
+    if (sym.nsignal != string::npos) {
+        parse_error_pos(tok.pos, "Identifier already defined as signal!");
         return -1;
     }
+    // parameters
+    if (lex.Accept("(")) {
+        while (!lex.Accept(")")) {
+            if (!new_macro.vsparams.empty() && (_parseDelim(lex, ",") == -1))
+                return -1;
+            if (_parseName(lex, &tok, "Identifier (of parameter) expected!") == -1)
+                return -1;
+            new_macro.vsparams.push_back(string(tok.p, tok.len));
+        }
+    }
+    if (_parseDelim(lex, "{") == -1)
+        return -1;
 
-    // parse for replacements
-    for (++cur_line; cur_line != g_vlines.end(); ++cur_line) {
-        if (cur_line->sline.find("}", 0) != string::npos) {
+    // find the end of the content
+    new_macro.ndefs = vdefs.size();
+    new_macro.nmacros = vmacros.size();
+    new_macro.nfirst = cur_line - ctx.vlines.begin() + 1;
+    for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+        if (cur_line->sline.find("}", 0) != string::npos)
             break;
-        }
-        // get full line replacement
-        p1 = cur_line->sline.find_first_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
-        p2 = cur_line->sline.find_last_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
-        if ((p1 == string::npos) || (p2 == string::npos)) {
-            parse_error("Identifier (of signal) expected!");
-            return -1;
-        }
-        // append
-        if (new_macro.scontent.empty())
-            new_macro.scontent = cur_line->sline.substr(p1, p2-p1+1);
-        else
-            new_macro.scontent += "," + cur_line->sline.substr(p1, p2-p1+1);
-        // replace spaces
-        while((p1 = new_macro.scontent.find(" ")) != string::npos)
-            new_macro.scontent.erase(p1, 1);
     }
+    if (cur_line == ctx.vlines.end())
+        return _unterminated();
+    new_macro.nlast = cur_line - ctx.vlines.begin();
+
+    // resolve the signals now, using the macro is just a merge of the patch
+    //  (with parameters: on first use of each argument tuple)
+    if (new_macro.vsparams.empty() && (_compileMacro(new_macro, NULL, new_macro.exp) == -1))
+        return -1;
 
     // add to list
+    sym.nmacro = vmacros.size();
     vmacros.push_back(new_macro);
 
     // debug info
-    debug("New macro: id:" << new_macro.sname << " rep:\"" << new_macro.scontent << "\"");
+    debug("New macro: id:" << new_macro.sname << " params:" << new_macro.vsparams.size());
+    for (size_t x = 0; x < new_macro.exp.patch.vnand.size(); ++x) {
+        debug("  and[" << x << "]: " << log_bin((unsigned)new_macro.exp.patch.vnand[x], signals_nbits+1));
+        debug("  or[" << x << "]:  " << log_bin((unsigned)new_macro.exp.patch.vnor[x], signals_nbits+1));
+    }
 
     return 1;
 }
 
 
+// compile the content of a macro into a patch (nargs: values of the parameters)
+//  done at definition and again if the defaults change ('!signal' depends on them)
+//  runs in parallel while ops are parsed, cur_line is only used for error messages
+int Parser::_compileMacro(const macros_t& macro, const long long *nargs, expansion_t& exp) {
+    vector<mcLines>::iterator saved_line = cur_line;
+    scope_t scope = {macro.ndefs, macro.nmacros, &macro, nargs, &exp.vndeps};
+    patch_t& patch = exp.patch;
+    int ret = 1;
+
+    exp.vndeps.clear();
+    patch_init(patch, signals_nchips + 1);
+    for (size_t n = macro.nfirst; n <= macro.nlast; ++n) {
+        if (!bquiet)
+            cur_line = ctx.vlines.begin() + n;
+        Lexer ll(ctx.vlines[n].sline);
+        if (_parseSignalList(ll, patch, scope) == -1) {
+            ret = -1;
+            break;
+        }
+        if (ll.Is("}"))
+            break;
+    }
+    if (!bquiet)
+        cur_line = saved_line;
+    deps_unique(exp.vndeps);
+    return ret;
+}
+
+
+// content of a macro for the given arguments, each argument tuple is compiled only once
+//  returns NULL on errors
+const expansion_t* Parser::_expandMacro(const macros_t& macro, const vector<long long>& vnargs) {
+    expansion_t exp;
+
+    if (macro.vsparams.empty())
+        return &macro.exp;
+    {
+        lock_guard<mutex> lock(expansions_mutex);
+        auto it = macro.mexpansions.find(vnargs);
+        if (it != macro.mexpansions.end())
+            return &it->second;
+    }
+    if (_compileMacro(macro, vnargs.data(), exp) == -1)
+        return NULL;
+    // (map nodes don't move, the pointer stays valid)
+    lock_guard<mutex> lock(expansions_mutex);
+    return &macro.mexpansions.insert(make_pair(vnargs, exp)).first->second;
+}
+
+
+// default signal words, built from #signals and #defaults
+void Parser::_updateDefaults() {
+    vndefaults.assign(signals_nchips + 1, 0);
+    for (auto& s : vsignals)
+        vndefaults[s.nchip] += s.defval << s.nstart;
+}
+
+
 // #defaults { }
 int Parser::ParseDefaults() {
-    for (++cur_line; cur_line != g_vlines.end(); ++cur_line) {
-        size_t p1, p2, sn;
-        int val;
-        string ss, sv;
-
-        if (cur_line->sline.find("}", 0) != string::npos) {
+    for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+        Lexer lex(cur_line->sline);
+        token_t tok;
+        size_t sn, pos;
+        long long val;
+
+        if (lex.Is("}")) {
+            deps_unique(vndefaults_deps);
+            // '!signal' in macros depends on the defaults (in order, they can be nested)
+            for (auto& m : vmacros) {
+                m.mexpansions.clear();
+                if (m.vsparams.empty() && (_compileMacro(m, NULL, m.exp) == -1))
+                    return -1;
+            }
             return 1;
         }
 
         // signal
-        ss = _parseName(0, &p1);
-        if (ss.empty()) {
-            parse_error_pos(7, "Identifier (of Signal) expected!");
+        if (_parseName(lex, &tok, "Identifier (of Signal) expected!") == -1)
+            return -1;
+        if ((sn = _findSignal(tok)) == string::npos) {
+            parse_error_pos(tok.pos, "Signal not defined!");
             return -1;
         }
         // delim
-        if ((p2 = _parseDelim(p1, "=")) == string::npos) {
-            parse_error_pos(p1, "Delimiter character '=' expected!");
+        if (_parseDelim(lex, "=") == -1)
             return -1;
-        }
         // value
-        if ((p1 = cur_line->sline.find_first_of("0123456789bx", p2)) == string::npos) {
-            parse_error_pos(p2, "Numeric value (for default value) expected!");
+        pos = lex.Peek().pos;
+        scope_t scope = {vdefs.size(), 0, NULL, NULL, &vndefaults_deps};
+        if (_evalExpr(lex, scope, &val) == -1)
             return -1;
-        }
-        sv = cur_line->sline.substr(p1);
-        // save
-        val = stoi(sv);
-        if (sv.size() > 2) {
-            if (sv.substr(0, 2) == "0x")
-                val = stoi(sv.substr(2), 0, 16);
-            else if (sv.substr(0, 2) == "0b")
-                val = stoi(sv.substr(2), 0, 2);
-        }
-        sn = _findSignal(ss);
-        if (sn == string::npos) {
-            parse_error("Signal not defined!");
+        if ((val < 0) || (val > bitmask(vsignals[sn].nnum))) {
+            parse_error_pos(pos, "Value exceeds width of signal!");
             return -1;
         }
-        vsignals[sn].defval = val;
+        // save
+        vsignals[sn].defval = (int)val;
 
         // debug info
-        debug("New default " << ss << "=" << sv << "(" << val << ")");
+        debug("New default " << vsignals[sn].sname << "=" << val);
     }
-    return 1;
+    return _unterminated();
 }
 
 
-// #op( ... ) { }
-int Parser::ParseOpcode() {
-    size_t p1, p2;
-    vector<string> vi, vs;
-    ops_t new_op = {0, 0, {}, "???"};
-
-    // name (optional)
-    p1 = cur_line->sline.find('{');
-    p1 = cur_line->sline.find_first_not_of(' ', p1+1);
-    if (p1 != string::npos)
-        new_op.sname = cur_line->sline.substr(p1);
-    // inputs
-    p1 = cur_line->sline.find('(');
-    p2 = cur_line->sline.find(')');
-    vi = split(cur_line->sline.substr(p1+1, p2-p1-1), ','); // split by ','
-    for (size_t i = 0; i < vi.size(); ++i) {
-        int ival=0, imask=0;
-        string ss;
-
-        // trim
-		p1 = vi[i].find_first_not_of(' ');
-        p2 = vi[i].find_last_not_of(' ');
-        ss = vi[i].substr(p1, p2-p1+1);
-        vi[i] = ss;
-        // test for defined identifier
-        if ((p1 = _findDefine(ss)) != string::npos) {
-            vi[i] = vdefs[p1].scontent;
-        }
-        // convert to num
-        if ((vi[i][0] != 'x') && (vi[i][0] != '*')) {
-            if (vi[i].size() > 2) {
-                if (vi[i].substr(0, 2) == "0b")
-                    ival = stoi(vi[i].substr(2), &p1, 2);
-                if (vi[i].substr(0, 2) == "0x")
-                    ival = stoi(vi[i].substr(2), &p1, 16);
-            }
-            else
-                ival = stoi(vi[i], &p1);
-            // mask
-            for (int x=0; x < vinputs[i].nnum; x++)
-                imask = (imask << 1) + 1;
-            // lshift to position of input
-            ival = ival << vinputs[i].nstart;
-            imask = imask << vinputs[i].nstart;
-            // save
-            new_op.nival += ival;
-            new_op.nimask += imask;
-        }
-    }
-
-    // signals
-    for (++cur_line; cur_line != g_vlines.end(); ++cur_line) {
-        vector<string> vstemp, vstemp2;
+// list of signals/macros, ',' separated (one line of an #op or a macro)
+//  adds all entries to the patch, stops at the end of line or '}'
+//  macros can have arguments: name(expr, ...)
+int Parser::_parseSignalList(Lexer& lex, patch_t& patch, const scope_t& scope) {
+    while (!lex.Is("}")) {
+        token_t tok = lex.Next();
+        size_t nsig;
+        bool binv = false;
+        int mask, val;
 
-        if (cur_line->sline.find("}", 0) != string::npos) {
+        if (tok.type == TOK_END)
             break;
+        if (tok_equals(tok, ","))
+            continue;
+        // inverted...
+        if (tok.type == TOK_NOT) {
+            binv = true;
+            tok = lex.Next();
         }
-        p1 = cur_line->sline.find_first_not_of(' ');
-        p2 = cur_line->sline.find_last_not_of(' ');
-        if((p1 == string::npos) || (p2 == string::npos)) {
-            parse_error("List of signals or macros expected!");
-        }
-        
-        vstemp = split(cur_line->sline.substr(p1, p2-p1+1), ','); // split by ','
-        for (size_t i = 0; i < vstemp.size(); ++i) { // trim
-            p1 = vstemp[i].find_first_not_of(' ');
-            p2 = vstemp[i].find_last_not_of(' ');
-            string ss = vstemp[i].substr(p1, p2-p1+1);
-            // replace spaces
-            while((p1 = ss.find(" ")) != string::npos)
-                ss.erase(p1, 1);
-            // ss = macro
-            if ((p1 = _findMacro(ss)) != string::npos) {
-                vstemp2 = split(vmacros[p1].scontent, ',');
-                vs.insert(vs.end(), vstemp2.begin(), vstemp2.end());
-            }
-            // ss = signal
-            else
-                vs.push_back(ss);
+        if ((tok.type != TOK_IDENT) && (tok.type != TOK_DONTCARE)) {
+            parse_error_pos(tok.pos, "Identifier (of signal or macro) expected!");
+            return -1;
         }
-    }
-    // signals - generate with default values
-    for (int x=0; x <= signals_nchips; ++x)
-        new_op.vnsignals.insert(new_op.vnsignals.begin(), 0);
-    for (auto s : vsignals)
-        new_op.vnsignals[s.nchip] += s.defval << s.nstart;
-    // signals - parse
-    for (auto s : vs) {
-        size_t nsig;
-        int val=0, mask=0;
-        // inverted...
-        if (s[0] == '!') {
-            if ((nsig = _findSignal(s.substr(1))) == string::npos) {
-                error("Signal '" << s.substr(1) << "' not defined!");
+        // macro (compiled already or on first use of the arguments)
+        if (!binv && ((nsig = _findMacro(tok)) != string::npos)) {
+            const macros_t& macro = vmacros[nsig];
+            const expansion_t *mexp;
+            vector<long long> vnargs;
+            // only macros defined before are visible, so there can't be any cycles
+            if (nsig >= scope.nmacros) {
+                if (scope.pmacro == &macro) {
+                    parse_error_pos(tok.pos, "Recursive use of macro '" << macro.sname << "'!");
+                } else {
+                    parse_error_pos(tok.pos, "Macro '" << macro.sname << "' used before its definition!");
+                }
+                return -1;
+            }
+            if (lex.Accept("(")) {
+                while (!lex.Accept(")")) {
+                    long long v;
+                    if (!vnargs.empty() && (_parseDelim(lex, ",") == -1))
+                        return -1;
+                    if (_evalExpr(lex, scope, &v) == -1)
+                        return -1;
+                    vnargs.push_back(v);
+                }
+            }
+            if (vnargs.size() != macro.vsparams.size()) {
+                parse_error_pos(tok.pos, "Macro '" << macro.sname << "' expects " << macro.vsparams.size() << " argument(s)!");
+                return -1;
+            }
+            if ((mexp = _expandMacro(macro, vnargs)) == NULL) {
+                parse_error_pos(tok.pos, "...in expansion of macro '" << macro.sname << "'");
                 return -1;
             }
-            for (int x=0; x < vsignals[nsig].nnum; x++)
-                mask = (mask << 1) + 1;
-            val = mask & (~vsignals[nsig].defval);
-            val = val << vsignals[nsig].nstart;
-            mask = mask << vsignals[nsig].nstart;
-            new_op.vnsignals[vsignals[nsig].nchip] = new_op.vnsignals[vsignals[nsig].nchip] & (~mask);
-            new_op.vnsignals[vsignals[nsig].nchip] += val;
+            patch_merge(patch, mexp->patch);
+            if (scope.pdeps)
+                scope.pdeps->insert(scope.pdeps->end(), mexp->vndeps.begin(), mexp->vndeps.end());
+            continue;
+        }
+        if ((nsig = _findSignal(tok)) == string::npos) {
+            parse_error_pos(tok.pos, "Signal '" << string(tok.p, tok.len) << "' not defined!");
+            return -1;
+        }
+        const signals_t& sig = vsignals[nsig];
+        mask = bitmask(sig.nnum);
+        // inverted default value
+        if (binv) {
+            val = mask & (~sig.defval);
         }
         // signal=value
-        else if ((p1 = s.find('=')) != string::npos) {
-            if ((nsig = _findSignal(s.substr(0, p1))) == string::npos) {
-                error("Signal '" << s.substr(0, p1) << "' not defined!");
+        else if (lex.Accept("=")) {
+            size_t pos = lex.Peek().pos;
+            long long v;
+            if (_evalExpr(lex, scope, &v) == -1)
+                return -1;
+            if ((v < 0) || (v > mask)) {
+                parse_error_pos(pos, "Value exceeds width of signal!");
                 return -1;
             }
-            val = stoi(s.substr(p1+1));
-            if (s.size() > p1+3) {
-                if (s[p1+2] == 'x')
-                    val = stoi(s.substr(p1+3), 0, 16);
-                else if (s[p1+2] == 'b')
-                    val = stoi(s.substr(p1+3), 0, 2);
-            }
-            for (int x=0; x < vsignals[nsig].nnum; x++)
-                mask = (mask << 1) + 1;
-            val = val << vsignals[nsig].nstart;
-            mask = mask << vsignals[nsig].nstart;
-            new_op.vnsignals[vsignals[nsig].nchip] = new_op.vnsignals[vsignals[nsig].nchip] & (~mask);
-            new_op.vnsignals[vsignals[nsig].nchip] += val;
+            val = (int)v;
         }
         // just the signal name (all bits to 1)
         else {
-            if ((nsig = _findSignal(s)) == string::npos) {
-                error("Signal '" << s << "' not defined!");
+            if (_chip(sig.nchip))
+                patch_apply(patch, sig.nchip, -1, mask << sig.nstart);
+            continue;
+        }
+        if (_chip(sig.nchip))
+            patch_apply(patch, sig.nchip, ~(mask << sig.nstart), val << sig.nstart);
+    }
+    return 1;
+}
+
+
+// values of one input of an #op: "expr", "expr..expr" or "{expr, expr..expr, ...}"
+int Parser::_parseInputValues(Lexer& lex, const scope_t& scope, size_t ninput, vector<range_t>& vranges) {
+    long long imask = bitmask(vinputs[ninput].nnum);
+    bool bset = lex.Accept("{");
+
+    do {
+        token_t tok;
+        range_t r;
+        if (bset && !vranges.empty() && (_parseDelim(lex, ",") == -1))
+            return -1;
+        tok = lex.Peek();
+        if (_evalExpr(lex, scope, &r.nfirst) == -1)
+            return -1;
+        r.nlast = r.nfirst;
+        if (lex.Accept("..") && (_evalExpr(lex, scope, &r.nlast) == -1))
+            return -1;
+        if ((r.nfirst < 0) || (r.nfirst > imask) || (r.nlast < 0) || (r.nlast > imask)) {
+            parse_error_pos(tok.pos, "Value exceeds width of input '" << vinputs[ninput].sname << "'!");
+            return -1;
+        }
+        if (r.nfirst > r.nlast) {
+            parse_error_pos(tok.pos, "Empty range (first value greater than last)!");
+            return -1;
+        }
+        vranges.push_back(r);
+    } while (bset && !lex.Accept("}"));
+
+    return 1;
+}
+
+
+// #op( ... ) { }
+//  runs in parallel: cur_line is the caller's iterator (shadows the member),
+//  only definitions/macros visible to the job are used
+int Parser::ParseOpcode(vector<mcLines>::iterator& cur_line, const opjob_t& job, ops_t& new_op) {
+    TraceSpan span(ctx.ptrace, "parse", "#op");
+    trace_line(span, ctx, *cur_line);
+    Lexer lex(cur_line->sline, 3);
+    scope_t scope = {job.ndefs, job.nmacros, NULL, NULL, &new_op.vndeps};
+    size_t ninput = 0;
+    cube_t all = { 0, 0 };
+
+    new_op.vcubes.assign(1, all);
+    new_op.sname = "???";
+    new_op.vndeps.clear();
+
+    // inputs
+    if (_parseDelim(lex, "(") == -1)
+        return -1;
+    while (!lex.Is(")")) {
+        token_t tok = lex.Peek();
+        int ntype = tok.type;
+        if ((ninput >= vinputs.size()) && (tok.type != TOK_ALL)) {
+            parse_error_pos(tok.pos, "More inputs given than defined in #inputs!");
+            return -1;
+        }
+        // definition of 'x' or '*'
+        if (tok.type == TOK_IDENT) {
+            size_t ndef = _findDefine(tok);
+            if ((ndef < job.ndefs) && (vdefs[ndef].ntype != TOK_NUMBER))
+                ntype = vdefs[ndef].ntype;
+        }
+        // ignored input(s)
+        if ((ntype == TOK_DONTCARE) || (ntype == TOK_ALL)) {
+            lex.Next();
+        }
+        // value, range or set (of values and ranges)
+        else {
+            vector<range_t> vranges;
+            vector<cube_t> vfield;
+            if (_parseInputValues(lex, scope, ninput, vranges) == -1)
                 return -1;
+            cubes_from_ranges(vranges, vinputs[ninput].nnum, vfield);
+            // lshift to position of input and combine with the other inputs
+            for (auto& c : vfield) {
+                c.nval  <<= vinputs[ninput].nstart;
+                c.nmask <<= vinputs[ninput].nstart;
             }
-            for (int x=0; x < vsignals[nsig].nnum; x++)
-                val = (val << 1) + 1;
-            val = val << vsignals[nsig].nstart;
-            new_op.vnsignals[vsignals[nsig].nchip] |= val;
+            cubes_product(new_op.vcubes, vfield);
         }
+        ++ninput;
+        // '*' ignores all following inputs
+        if ((ntype == TOK_ALL) && !lex.Is(")")) {
+            parse_error_pos(lex.Peek().pos, "')' expected ('*' must be the last input)!");
+            return -1;
+        }
+        if (!lex.Is(")") && (_parseDelim(lex, ",") == -1))
+            return -1;
     }
+    lex.Next();
+    if (_parseDelim(lex, "{") == -1)
+        return -1;
+    // name (optional)
+    if (lex.Peek().type != TOK_END)
+        new_op.sname = cur_line->sline.substr(lex.Peek().pos);
 
-    // insert in list
-    vops.push_back(new_op);
+    // signals - parse
+    patch_t patch;
+    patch_init(patch, signals_nchips + 1);
+    for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+        Lexer ll(cur_line->sline);
+        if (_parseSignalList(ll, patch, scope) == -1)
+            return -1;
+        if (ll.Is("}"))
+            break;
+    }
+    if (cur_line == ctx.vlines.end())
+        return _unterminated();
+    // signals - apply to the default values
+    new_op.vnsignals.resize(signals_nchips + 1);
+    for (int x = 0; x <= signals_nchips; ++x)
+        new_op.vnsignals[x] = (vndefaults[x] & patch.vnand[x]) | patch.vnor[x];
+    new_op.vndeps.insert(new_op.vndeps.end(), vndefaults_deps.begin(), vndefaults_deps.end());
+    deps_unique(new_op.vndeps);
 
     // debug info
     debug("New opcode(" << new_op.sname << ")");
-    debug("  inputs value: " << cout_int2bin(new_op.nival, inputs_nbits+1));
-    debug("  inputs mask:  " << cout_int2bin(new_op.nimask, inputs_nbits+1));
+    for (auto& c : new_op.vcubes) {
+        debug("  inputs value: " << log_bin((unsigned)c.nval, inputs_nbits+1));
+        debug("  inputs mask:  " << log_bin((unsigned)c.nmask, inputs_nbits+1));
+    }
     for (int x=0; x <= signals_nchips; ++x)
-        debug("  signals[" << x << "]: " << cout_int2bin(new_op.vnsignals[x], signals_nbits+1));
+        debug("  signals[" << x << "]: " << log_bin((unsigned)new_op.vnsignals[x], signals_nbits+1));
+
+    return 1;
+}
+
+
+// line starting an #op block (the block ends with the next line containing a '}')
+static bool is_op_start(const string& sline) {
+    return (sline.compare(0, 3, "#op") == 0) &&
+           (sline.find("(") != string::npos) &&
+           (sline.find(")") != string::npos) &&
+           (sline.find("{") != string::npos);
+}
+
+
+// watch mode: the lines outside of the #op blocks and where the blocks are between them
+void Parser::_splitOps() {
+    snonops.clear();
+    mopstarts.clear();
+    for (auto it = ctx.vlines.begin(); it != ctx.vlines.end(); ++it) {
+        if (!is_op_start(it->sline)) {
+            snonops += it->sline;
+            snonops += '\n';
+            continue;
+        }
+        mopstarts[it - ctx.vlines.begin()] = snonops.size();
+        for (++it; it != ctx.vlines.end(); ++it) {
+            if (it->sline.find("}", 0) != string::npos)
+                break;
+        }
+        if (it == ctx.vlines.end())
+            break;
+    }
+}
+
+
+// text of an #op block and where it is (between the same other lines the same text
+//  gives the same op)
+string Parser::_opKey(const opjob_t& job) const {
+    auto it = mopstarts.find(job.nline);
+    string s = to_string((it != mopstarts.end()) ? it->second : string::npos);
+    for (size_t n = job.nline; n <= job.nlast; ++n) {
+        s += '\n';
+        s += ctx.vlines[n].sline;
+    }
+    return s;
+}
+
+
+// parse all queued #op blocks (in parallel if worth it) and append them in source order
+// variant: take the op from the base if it doesn't depend on a changed definition
+//  (the source is the same, so the nth op here is the nth op there)
+// watch mode: take the op from the last version if its block is the same
+bool Parser::_reuseOp(size_t njob, ops_t& op) {
+    if (pbase) {
+        const ops_t& base = pbase->vops[vops.size() + njob];
+        for (auto d : base.vndeps) {
+            if (vchanged[d]) {
+                ++nreparsed;
+                return false;
+            }
+        }
+        op = base;
+        return true;
+    }
+    if (bsameprev) {
+        auto it = pprev->mopblocks.find(_opKey(vopjobs[njob]));
+        if (it != pprev->mopblocks.end()) {
+            op = pprev->vops[it->second];
+            return true;
+        }
+        ++nreparsed;
+    }
+    return false;
+}
+
 
+int Parser::_flushOps() {
+    StatsTimer timer(ctx.pstats, "parse/#op");
+    TraceSpan span(ctx.ptrace, "parse", "#op blocks");
+    span.Arg("ops", (long long)vopjobs.size());
+    size_t njobs = vopjobs.size();
+    vector<ops_t> vres(njobs);
+    int nthreads = min(ctx.cfg.nthreads, (int)((njobs + OPS_PER_THREAD - 1) / OPS_PER_THREAD));
+
+    if (njobs == 0)
+        return 1;
+
+    // variant: which definitions have another value than in the base
+    if (pbase) {
+        vchanged.assign(vdefs.size(), 0);
+        for (size_t d = 0; d < vdefs.size(); ++d)
+            vchanged[d] = (vdefs[d].nval != pbase->vdefs[d].nval);
+    }
+
+    // sequential (also needed to keep the debug output in order)
+    if ((nthreads <= 1) || ctx.plog->On(LOG_PARSER, LOG_DEBUG)) {
+        for (size_t n = 0; n < njobs; ++n) {
+            if (_reuseOp(n, vres[n]))
+                continue;
+            cur_line = ctx.vlines.begin() + vopjobs[n].nline;
+            if (ParseOpcode(cur_line, vopjobs[n], vres[n]) == -1)
+                return -1;
+        }
+    }
+    // parallel, the symbol tables are read only meanwhile
+    else {
+        vector<char> vfailed(njobs, 0);
+        vector<thread> vthreads;
+        atomic<size_t> nnext(0);
+
+        bquiet = true;
+        for (int t = 0; t < nthreads; ++t) {
+            vthreads.push_back(thread([&]() {
+                TraceSpan span(ctx.ptrace, "parse", "parse worker");
+                size_t first;
+                while ((first = nnext.fetch_add(OPS_PER_CHUNK)) < njobs) {
+                    size_t last = min(first + OPS_PER_CHUNK, njobs);
+                    for (size_t n = first; n < last; ++n) {
+                        if (_reuseOp(n, vres[n]))
+                            continue;
+                        vector<mcLines>::iterator line = ctx.vlines.begin() + vopjobs[n].nline;
+                        if (ParseOpcode(line, vopjobs[n], vres[n]) == -1)
+                            vfailed[n] = 1;
+                    }
+                }
+                nlookups += nthreadlookups;
+                nthreadlookups = 0;
+            }));
+        }
+        for (auto& t : vthreads)
+            t.join();
+        bquiet = false;
+
+        // report the first error (parse it again, not muted this time)
+        for (size_t n = 0; n < njobs; ++n) {
+            if (vfailed[n]) {
+                cur_line = ctx.vlines.begin() + vopjobs[n].nline;
+                ParseOpcode(cur_line, vopjobs[n], vres[n]);
+                return -1;
+            }
+        }
+    }
+
+    // insert in list (and remember the blocks for the next version)
+    if (bkeepops) {
+        for (size_t n = 0; n < njobs; ++n)
+            mopblocks[_opKey(vopjobs[n])] = vops.size() + n;
+    }
+    vops.insert(vops.end(), vres.begin(), vres.end());
+    vopjobs.clear();
     return 1;
 }
 
 
+// move the parsed ops into one block of the arena
+void Parser::_buildOpTable() {
+    StatsTimer t(ctx.pstats, "parse/op table");
+    TraceSpan span(ctx.ptrace, "parse", "op table");
+    size_t nops = vops.size();
+    size_t nchips = signals_nchips + 1;
+    size_t ncubes = 0;
+    size_t nnames = 0;
+
+    for (auto& op : vops) {
+        ncubes += op.vcubes.size();
+        nnames += op.sname.size() + 1;
+    }
+    arena.Clear();
+    arena.Reserve(ncubes * 3 * sizeof(int) + nops * nchips * sizeof(int) + nops * sizeof(char *) + nnames + 5 * alignof(max_align_t));
+
+    optable.nops     = nops;
+    optable.nchips   = nchips;
+    optable.ncubes   = ncubes;
+    optable.nival    = arena.AllocArray<int>(ncubes);
+    optable.nimask   = arena.AllocArray<int>(ncubes);
+    optable.nop      = arena.AllocArray<int>(ncubes);
+    optable.nsignals = arena.AllocArray<int>(nops * nchips);
+    optable.snames   = arena.AllocArray<const char *>(nops);
+    for (size_t i = 0, c = 0; i < nops; ++i) {
+        for (auto& cube : vops[i].vcubes) {
+            optable.nival[c]  = cube.nval;
+            optable.nimask[c] = cube.nmask;
+            optable.nop[c]    = i;
+            ++c;
+        }
+        for (size_t x = 0; x < nchips; ++x)
+            optable.nsignals[i * nchips + x] = vops[i].vnsignals[x];
+        char *name = arena.AllocArray<char>(vops[i].sname.size() + 1);
+        memcpy(name, vops[i].sname.c_str(), vops[i].sname.size() + 1);
+        optable.snames[i] = name;
+    }
+    if (!bkeepops)
+        vector<ops_t>().swap(vops);
+    matcher.Build(optable.ncubes, optable.nival, optable.nimask, optable.nop, inputs_nbits + 1);
+}
+
+
 int Parser::Parse() {
+    TraceSpan span(ctx.ptrace, "parse", "Parse");
     silent("Parsing...");
-    for (cur_line = g_vlines.begin(); cur_line != g_vlines.end(); ++cur_line) {
+    _updateDefaults();
+    bquiet = false;
+    // watch mode: the ops of the last version can be reused if nothing else has changed
+    if (bkeepops || pprev)
+        _splitOps();
+    bsameprev = pprev && pprev->bkeepops && (snonops == pprev->snonops);
+    if (pprev && !bsameprev)
+        debug("Not only #op blocks have changed, parsing all of them again");
+    for (cur_line = ctx.vlines.begin(); cur_line != ctx.vlines.end(); ++cur_line) {
         // #inputs {
         if ((cur_line->sline.compare(0, 7, "#inputs") == 0) &&
                 (cur_line->sline.find("{") != string::npos)) {
+            if (_flushOps() == -1)
+                return -1;
+            StatsTimer t(ctx.pstats, "parse/#inputs");
+            TraceSpan span(ctx.ptrace, "parse", "#inputs");
+            trace_line(span, ctx, *cur_line);
             if (ParseInputs() == -1)
                 return -1;
             silent("Number of input bits found: 0.." << inputs_nbits);
@@ -562,8 +1204,14 @@ int Parser::Parse() {
         // #signals {
         if ((cur_line->sline.compare(0, 8, "#signals") == 0) &&
                 (cur_line->sline.find("{") != string::npos)) {
+            if (_flushOps() == -1)
+                return -1;
+            StatsTimer t(ctx.pstats, "parse/#signals");
+            TraceSpan span(ctx.ptrace, "parse", "#signals");
+            trace_line(span, ctx, *cur_line);
             if (ParseSignals() == -1)
                 return -1;
+            _updateDefaults();
             if (signals_nchips > 0) {
                 silent("Number of signal bits found: 0.." << signals_nchips << ":0.." << signals_nbits);
             } else {
@@ -571,18 +1219,24 @@ int Parser::Parse() {
             }
             continue;
         }
-        // #define (constants)
+        // #define (macros, may have parameters in ( ))
         if ((cur_line->sline.compare(0, 7, "#define") == 0) &&
-                (cur_line->sline.find("(") != string::npos) &&
-                (cur_line->sline.find(")") != string::npos)) {
-            if (ParseDefines() == -1)
+                (cur_line->sline.find("{") != string::npos)) {
+            StatsTimer t(ctx.pstats, "parse/#define (macro)");
+            TraceSpan span(ctx.ptrace, "parse", "#define (macro)");
+            trace_line(span, ctx, *cur_line);
+            if (ParseMacros() == -1)
                 return -1;
             continue;
         }
-        // #define (macros)
+        // #define (constants)
         if ((cur_line->sline.compare(0, 7, "#define") == 0) &&
-                (cur_line->sline.find("{") != string::npos)) {
-            if (ParseMacros() == -1)
+                (cur_line->sline.find("(") != string::npos) &&
+                (cur_line->sline.find(")") != string::npos)) {
+            StatsTimer t(ctx.pstats, "parse/#define");
+            TraceSpan span(ctx.ptrace, "parse", "#define");
+            trace_line(span, ctx, *cur_line);
+            if (ParseDefines() == -1)
                 return -1;
             continue;
         }
@@ -593,21 +1247,32 @@ int Parser::Parse() {
                 parse_error("Signals must be defined before!");
                 return -1;
             }
+            if (_flushOps() == -1)
+                return -1;
+            StatsTimer t(ctx.pstats, "parse/#defaults");
+            TraceSpan span(ctx.ptrace, "parse", "#defaults");
+            trace_line(span, ctx, *cur_line);
             if (ParseDefaults() == -1)
                 return -1;
+            _updateDefaults();
             continue;
         }
         // #op() {
-        if ((cur_line->sline.compare(0, 3, "#op") == 0) &&
-                (cur_line->sline.find("(") != string::npos) &&
-                (cur_line->sline.find(")") != string::npos) &&
-                (cur_line->sline.find("{") != string::npos)) {
+        if (is_op_start(cur_line->sline)) {
             if ((inputs_nbits == 0) || (signals_nbits == 0)) {
                 parse_error("Inputs and signals must be defined before!");
                 return -1;
             }
-            if (ParseOpcode() == -1)
-                return -1;
+            // queue it with the symbols visible at this point, parsed by _flushOps()
+            opjob_t job = {(size_t)(cur_line - ctx.vlines.begin()), vdefs.size(), vmacros.size(), 0};
+            for (++cur_line; cur_line != ctx.vlines.end(); ++cur_line) {
+                if (cur_line->sline.find("}", 0) != string::npos)
+                    break;
+            }
+            if (cur_line == ctx.vlines.end())
+                return _unterminated();
+            job.nlast = cur_line - ctx.vlines.begin();
+            vopjobs.push_back(job);
             continue;
         }
         // none of the above -> error
@@ -615,93 +1280,465 @@ int Parser::Parse() {
         return -1;
     }
 
-    silent("Parsing... done (" << vops.size() << " ops/instructions)");
+    if (_flushOps() == -1)
+        return -1;
+    // all overridden definitions must exist
+    if (poverrides) {
+        for (auto& o : *poverrides) {
+            int n = symbols.Find(o.first);
+            if ((n < 0) || (vsyms[n].ndefine == string::npos)) {
+                error("Definition '" << o.first << "' (-D) not defined!");
+                return -1;
+            }
+        }
+    }
+    // all selected chips must exist
+    for (size_t x = signals_nchips + 1; x < vbchips.size(); ++x) {
+        if (vbchips[x]) {
+            error("Chip " << x << " not defined (chips are 0.." << signals_nchips << ")!");
+            return -1;
+        }
+    }
+    if (pbase || bsameprev) {
+        silent("Parsing... done (" << vops.size() << " ops/instructions, " << nreparsed << " parsed again)");
+    } else {
+        silent("Parsing... done (" << vops.size() << " ops/instructions)");
+    }
+    _buildOpTable();
+    nlookups += nthreadlookups;
+    nthreadlookups = 0;
+    if (ctx.pstats) {
+        ctx.pstats->Add("ops", optable.nops);
+        ctx.pstats->Add("op cubes", optable.ncubes);
+        if (pbase)
+            ctx.pstats->Add("ops parsed again (variant)", nreparsed);
+        if (bsameprev)
+            ctx.pstats->Add("ops parsed again (watch)", nreparsed);
+        ctx.pstats->Add("symbol lookups", nlookups);
+    }
     return 1;
 }
 
 
-int Parser::Generate(const string& out_file) {
-    silent("Generating...");
+// generate the words of the addresses nfirst..nlast (-1 = up to the last address)
+int Parser::Build(image_t& image, int nfirst, int nlast) {
+    StatsTimer t(ctx.pstats, "generate");
+    silent_gen("Generating...");
 
-    int nmaxinval=0;
     int nmatches=0;
-    vector<FILE *> vfile;
-    vector<int> vndefault;
-    vector<string> vsdefault;
+    int nmaxinval = bitmask(inputs_nbits + 1);
 
-    // max inval
-    for (int x=0; x <= inputs_nbits; x++)
-        nmaxinval = (nmaxinval << 1) + 1;
+    if (nlast < 0)
+        nlast = nmaxinval;
+    if ((nfirst < 0) || (nfirst > nlast) || (nlast > nmaxinval)) {
+        error("Invalid address range 0x" << hex << nfirst << "..0x" << nlast
+              << " (addresses are 0x0..0x" << nmaxinval << ")" << dec);
+        return -1;
+    }
 
-    // create outfiles
-    silent("Opening target files...");
-    for (int x=0; x <= signals_nchips; ++x) {
-        FILE * pfile;
-        string sfile;
+    image.naddrbits = inputs_nbits + 1;
+    image.nchips = signals_nchips + 1;
+    image.nfirst = nfirst;
+    image.nwords = nlast - nfirst + 1;
+    image.nwordbits = signals_nbits + 1;
+    image.vnwords.resize((size_t)image.nchips * image.nwords);
+    image.vndefaults = vndefaults;
+    image.vnsources.resize(image.nchips);
+    image.nsource = SourceHash();
+    image.vbchips.resize(image.nchips);
+    vector<int> vnchips;    // the selected ones
+    for (int x=0; x < image.nchips; ++x) {
+        image.vnsources[x] = Hash(x);
+        image.vbchips[x] = _chip(x);
+        if (image.vbchips[x])
+            vnchips.push_back(x);
+    }
 
-        // i hate that code snipped...
-        char buf[128];
-        int n;
-        n = snprintf(buf, sizeof(buf), out_file.c_str(), x);
-        if (n<0) {
-            error("Internal error: parser.cpp " << __LINE__);
-            return -1;
+    // the loop (in blocks, each one is a span of the trace)
+    long long nprobes = 0;
+    long long *pnprobes = ctx.pstats ? &nprobes : NULL;
+    // (every match only with --log=g:trace, there are 2^N of them)
+    bool btrace = ctx.plog->On(LOG_GENERATOR, LOG_TRACE);
+    bool bprogress = ctx.cfg.p && !ctx.cfg.s;
+    auto tstart = chrono::steady_clock::now();
+    double dnext = PROGRESS_DELAY;  // time of the next progress line
+    bool bshown = false;
+    for (long long nblock=nfirst; nblock <= nlast; nblock += GENERATE_BLOCK) {
+        // progress (once a block, so the loop never waits for it)
+        if (bprogress && (nblock > nfirst)) {
+            double d = chrono::duration<double>(chrono::steady_clock::now() - tstart).count();
+            if (d >= dnext) {
+                double drate = (nblock - nfirst) / d;
+                char buf[128];
+                snprintf(buf, sizeof(buf), "\rGenerating: %3d%%, %.2f M addresses/s, ETA %.0f s   ",
+                         (int)(100 * (nblock - nfirst) / ((long long)nlast - nfirst + 1)),
+                         drate / 1e6, (nlast - nblock + 1) / drate);
+                *ctx.perr << buf << flush;
+                dnext = d + PROGRESS_INTERVAL;
+                bshown = true;
+            }
         }
-        sfile = buf;
 
-        silent("File: " << sfile);
-        if ((pfile = fopen(sfile.c_str(), "w")) == NULL) {
-            error("Can't open file: " << sfile);
-            return -1;
+        int nend = (int)min((long long)nlast, nblock + GENERATE_BLOCK - 1);
+        int nblockmatches = nmatches;
+        TraceSpan span(ctx.ptrace, "generate", "generate block");
+        span.Arg("first", nblock);
+        span.Arg("last", nend);
+        for (int inval=(int)nblock; inval <= nend; inval++) {
+            const int *nsignals;
+
+            // check if opcode matches
+            int i;
+            nsignals = breference ? ExpectReference(inval, &i) : Expect(inval, &i, pnprobes);
+            if (i >= 0) {
+                if (btrace)
+                    trace_gen("Match: " << log_bin((unsigned)inval, inputs_nbits+1) << " => " << optable.snames[i]);
+                ++nmatches;
+            }
+            // matching signals (or the defaults)
+            for (auto x : vnchips)
+                image.vnwords[(size_t)x * image.nwords + (inval - nfirst)] = nsignals[x];
         }
-        // write header for Logisim format
-        fputs("v2.0 raw\n", pfile);
-        // add to filelist
-        vfile.push_back(pfile);
+        debug_gen("Block 0x" << hex << nblock << "..0x" << nend << dec << ": " << nmatches - nblockmatches << " matches");
     }
+    if (bshown) {
+        double d = chrono::duration<double>(chrono::steady_clock::now() - tstart).count();
+        char buf[128];
+        snprintf(buf, sizeof(buf), "\rGenerating: 100%%, %.2f M addresses/s, %.1f s            \n",
+                 ((long long)nlast - nfirst + 1) / d / 1e6, d);
+        *ctx.perr << buf << flush;
+    }
+
+    _imageSymbols(image);
 
-    // default signals value
-    for (int x=0; x<=signals_nchips; ++x) {
-        vndefault.push_back(0);
-        vsdefault.push_back("");
+    if (ctx.pstats) {
+        ctx.pstats->Add("addresses generated", image.nwords);
+        ctx.pstats->Add("match probes", nprobes);
     }
-    for (auto s : vsignals)
-        vndefault[s.nchip] += s.defval << s.nstart;
-    for (int x=0; x<=signals_nchips; ++x) {
-        char buf[128];
-        sprintf(buf, "%X", vndefault[x]);
-        vsdefault[x] = buf;
-    }
-    
-    // the loop
-    for (int inval=0; inval<=nmaxinval; inval++) {
-        bool match=false;
-
-        // check if opcode matches
-        for (size_t i=0; i < vops.size(); ++i) {
-            if ((inval & vops[i].nimask) == vops[i].nival) {
-                debug_gen("Match: " << cout_int2bin(inval, inputs_nbits+1) << " => " << vops[i].sname);
-                ++nmatches;
-                match = true;
-                // write matching signals
-                for (int x=0; x<=signals_nchips; ++x) {
-                    char buf[128];
-                    sprintf(buf, "%X\n", vops[i].vnsignals[x]);
-                    fputs(buf, vfile[x]);
+    silent_gen("Generating... done (" << nmatches << " matches)");
+    return 1;
+}
+
+
+// symbol tables of an image
+void Parser::_imageSymbols(image_t& image) const {
+    image.vinputs = vinputs;
+    image.vsignals = vsignals;
+    image.vdefs.clear();
+    for (auto& d : vdefs) {
+        if (d.ntype == TOK_NUMBER)
+            image.vdefs.push_back(d);
+    }
+    image.vsops.assign(optable.snames, optable.snames + optable.nops);
+}
+
+
+// watch mode: cubes of the ops that differ from the ones of prev (changed, added, removed
+//  or moved), all addresses outside of them get the same words from both sources
+//  false if more than the ops differs (sizes or defaults), then all addresses may have changed
+bool Parser::Changes(const Parser& prev, vector<cube_t>& vcubes) const {
+    StatsTimer t(ctx.pstats, "generate/changes");
+    vcubes.clear();
+    if ((inputs_nbits != prev.inputs_nbits) || (signals_nchips != prev.signals_nchips) ||
+            (signals_nbits != prev.signals_nbits) || (vndefaults != prev.vndefaults))
+        return false;
+
+    // an op is its cubes and words (names don't matter), as one string
+    auto ops = [](const optable_t& tab, vector<string>& vsops, vector<vector<cube_t> >& vvcubes) {
+        vsops.assign(tab.nops, string());
+        vvcubes.assign(tab.nops, vector<cube_t>());
+        for (int c = 0; c < tab.ncubes; ++c) {
+            cube_t cube = { tab.nival[c], tab.nimask[c] };
+            vvcubes[tab.nop[c]].push_back(cube);
+            vsops[tab.nop[c]].append((const char *)&cube, sizeof(cube));
+        }
+        for (int n = 0; n < tab.nops; ++n)
+            vsops[n].append((const char *)(tab.nsignals + n * tab.nchips), tab.nchips * sizeof(int));
+    };
+    vector<string> vsold, vsnew;
+    vector<vector<cube_t> > vvold, vvnew;
+    ops(prev.optable, vsold, vvold);
+    ops(optable, vsnew, vvnew);
+
+    // the same ops in the same order are kept, each new op takes the next equal old one
+    map<string, vector<int> > mold;     // op -> old ops (ascending)
+    for (int n = (int)vsold.size() - 1; n >= 0; --n)
+        mold[vsold[n]].push_back(n);
+    vector<bool> vbkept(vsold.size(), false);
+    int nlastold = -1;
+    for (size_t n = 0; n < vsnew.size(); ++n) {
+        auto it = mold.find(vsnew[n]);
+        if (it != mold.end()) {
+            vector<int>& v = it->second;    // (descending, the next one at the back)
+            while (!v.empty() && (v.back() <= nlastold))
+                v.pop_back();
+            if (!v.empty()) {
+                nlastold = v.back();
+                vbkept[nlastold] = true;
+                v.pop_back();
+                continue;
+            }
+        }
+        vcubes.insert(vcubes.end(), vvnew[n].begin(), vvnew[n].end());
+    }
+    for (size_t n = 0; n < vsold.size(); ++n) {
+        if (!vbkept[n])
+            vcubes.insert(vcubes.end(), vvold[n].begin(), vvold[n].end());
+    }
+    return true;
+}
+
+
+// watch mode: generate the addresses of vcubes again, the other words of image (from Build()
+//  of a source with the same sizes, see Changes()) are kept
+//  vbchanged gets the chips with changed words, returns the number of addresses generated
+long long Parser::Rebuild(image_t& image, const vector<cube_t>& vcubes, vector<bool>& vbchanged) {
+    StatsTimer t(ctx.pstats, "generate");
+    TraceSpan span(ctx.ptrace, "generate", "Rebuild");
+    int nfield = bitmask(inputs_nbits + 1);
+    long long nfirst = image.nfirst;
+    long long nlast = nfirst + image.nwords - 1;
+    long long naddrs = 0;
+    vector<int> vnchips;    // the selected ones
+
+    vbchanged.assign(image.nchips, false);
+    image.nsource = SourceHash();
+    for (int x = 0; x < image.nchips; ++x) {
+        image.vnsources[x] = Hash(x);
+        if (image.vbchips[x])
+            vnchips.push_back(x);
+    }
+    for (auto& c : vcubes) {
+        int nfree = ~c.nmask & nfield;
+        for (int sub = nfree; ; sub = (sub - 1) & nfree) {
+            int naddr = (c.nval & nfield) | sub;
+            if ((naddr >= nfirst) && (naddr <= nlast)) {
+                int nop;
+                const int *nsignals = breference ? ExpectReference(naddr, &nop) : Expect(naddr, &nop);
+                for (auto x : vnchips) {
+                    int& nword = image.vnwords[(size_t)x * image.nwords + (naddr - nfirst)];
+                    if (nword != nsignals[x]) {
+                        nword = nsignals[x];
+                        vbchanged[x] = true;
+                    }
                 }
+                ++naddrs;
+            }
+            if (sub == 0)
                 break;
+        }
+    }
+    _imageSymbols(image);
+    span.Arg("addresses", naddrs);
+    if (ctx.pstats)
+        ctx.pstats->Add("addresses generated", naddrs);
+    return naddrs;
+}
+
+
+// signal words of an address (one for each chip), pnop gets the op (-1 = defaults)
+//  read only, can be used by several threads
+//  pnprobes (if not NULL) gets the number of cubes compared added
+const int* Parser::Expect(int naddr, int *pnop, long long *pnprobes) const {
+    int i = matcher.Find(naddr, pnprobes);
+    if (pnop)
+        *pnop = i;
+    if (i < 0)
+        return vndefaults.data();
+    return optable.nsignals + i * optable.nchips;
+}
+
+
+// the same as Expect(), but tries all cubes in the order of the source
+//  slow, kept as the reference for the Matcher and everything built on it
+const int* Parser::ExpectReference(int naddr, int *pnop) const {
+    for (int c = 0; c < optable.ncubes; ++c) {
+        if ((naddr & optable.nimask[c]) == optable.nival[c]) {
+            *pnop = optable.nop[c];
+            return optable.nsignals + optable.nop[c] * optable.nchips;
+        }
+    }
+    *pnop = -1;
+    return vndefaults.data();
+}
+
+
+// signal words of an op (one for each chip), nop -1 gives the defaults
+const int* Parser::Words(int nop) const {
+    if (nop < 0)
+        return vndefaults.data();
+    return optable.nsignals + nop * optable.nchips;
+}
+
+
+// FNV-1a (64 bit) of what the source generates for a chip: the address and word
+//  sizes, the op cubes and the defaults and words of the chip (the same for the
+//  same ROM contents, whatever the text)
+unsigned long long Parser::Hash(int nchip) const {
+    unsigned long long h = 14695981039346656037ull;
+    auto add = [&h](int n) {
+        for (int b = 0; b < 4; ++b) {
+            h ^= (unsigned char)(n >> (b * 8));
+            h *= 1099511628211ull;
+        }
+    };
+
+    add(inputs_nbits);
+    add(signals_nchips);
+    add(signals_nbits);
+    add(vndefaults[nchip]);
+    for (int c = 0; c < optable.ncubes; ++c) {
+        add(optable.nival[c]);
+        add(optable.nimask[c]);
+        add(optable.nop[c]);
+    }
+    for (int n = 0; n < optable.nops; ++n)
+        add(optable.nsignals[n * optable.nchips + nchip]);
+    return h;
+}
+
+
+// FNV-1a (64 bit) of the whole source: the cleaned lines and the -D overrides
+//  (not of the words, the chips not selected (--chip) have none, so each chip
+//  generated separately gets the same)
+unsigned long long Parser::SourceHash() const {
+    unsigned long long h = 14695981039346656037ull;
+    auto add = [&h](const string& s) {
+        for (size_t i = 0; i <= s.size(); ++i) {
+            h ^= (unsigned char)s.c_str()[i];   // (with the '\0' between the strings)
+            h *= 1099511628211ull;
+        }
+    };
+
+    for (auto& l : ctx.vlines)
+        add(l.sline);
+    if (poverrides) {
+        for (auto& o : *poverrides) {
+            add(o.first);
+            add(to_string(o.second));
+        }
+    }
+    return h;
+}
+
+
+// the address space split into disjoint cubes, each with the op that wins there
+//  (-1 = no op, defaults), works on the cubes only and never on single addresses
+void Parser::Regions(vector<cube_t>& vcubes, vector<int>& vnops) const {
+    cube_t all = { 0, 0 };
+    vector<cube_t> vrest(1, all);   // not owned by an op so far
+    vector<cube_t> vnext;
+
+    for (int c = 0; c < optable.ncubes; ++c) {
+        cube_t cube = { optable.nival[c], optable.nimask[c] };
+        vnext.clear();
+        for (auto& r : vrest) {
+            cube_t owned;
+            if (!cube_intersect(r, cube, owned)) {
+                vnext.push_back(r);
+                continue;
             }
+            vcubes.push_back(owned);
+            vnops.push_back(optable.nop[c]);
+            cube_subtract(r, cube, vnext);
         }
-        // no match found
-        if (!match) {
-            // write default signals
-            for (int x=0; x<=signals_nchips; ++x) {
-                fputs(vsdefault[x].c_str(), vfile[x]);
-                fputs("\n", vfile[x]);
+        vrest.swap(vnext);
+    }
+    for (auto& r : vrest) {
+        vcubes.push_back(r);
+        vnops.push_back(-1);
+    }
+}
+
+
+// addresses of each op (won and matched), the ops shadowing them and what is left to
+//  the defaults, from the regions (see above) without touching single addresses
+void Parser::Coverage(coverage_t& cov) const {
+    StatsTimer t(ctx.pstats, "coverage");
+    int nbits = inputs_nbits + 1;
+    int nfield = bitmask(nbits);
+    auto size = [&](const cube_t& c) {
+        return 1LL << (nbits - __builtin_popcount(c.nmask & nfield));
+    };
+    vector<cube_t> vcubes;
+    vector<int> vnops;
+    vector<cube_t> vrest;   // won by no op
+    vector<cube_t> vall;    // all cubes of the ops
+
+    Regions(vcubes, vnops);
+    cov.naddrbits = nbits;
+    cov.vops.assign(optable.nops, opcover_t());
+    cov.nuncovered = 0;
+    for (size_t r = 0; r < vcubes.size(); ++r) {
+        if (vnops[r] >= 0)
+            cov.vops[vnops[r]].nowned += size(vcubes[r]);
+        else {
+            cov.nuncovered += size(vcubes[r]);
+            vrest.push_back(vcubes[r]);
+        }
+    }
+
+    // matched by each op (its cubes may overlap), the earlier ops taking some of it
+    for (int c = 0; c < optable.ncubes; ) {
+        int nop = optable.nop[c];
+        int nfirstcube = c;
+        opcover_t& op = cov.vops[nop];
+        vector<cube_t> vown;
+        for (; (c < optable.ncubes) && (optable.nop[c] == nop); ++c) {
+            cube_t cube = { optable.nival[c], optable.nimask[c] };
+            vector<cube_t> vpieces(1, cube), vnext;
+            for (auto& o : vown) {
+                vnext.clear();
+                for (auto& p : vpieces)
+                    cube_subtract(p, o, vnext);
+                vpieces.swap(vnext);
             }
+            for (auto& p : vpieces)
+                op.nmatched += size(p);
+            vown.push_back(cube);
+            vall.push_back(cube);
         }
+        if (op.nowned == op.nmatched)
+            continue;
+        for (int e = 0; (e < nfirstcube) && ((int)op.vnshadows.size() < COVERAGE_SHADOWS); ++e) {
+            cube_t other = { optable.nival[e], optable.nimask[e] }, tmp;
+            if (!op.vnshadows.empty() && (op.vnshadows.back() == optable.nop[e]))
+                continue;
+            for (auto& o : vown) {
+                if (cube_intersect(o, other, tmp)) {
+                    op.vnshadows.push_back(optable.nop[e]);
+                    break;
+                }
+            }
+        }
+    }
+
+    // the rest as few cubes as possible
+    cubes_minimize(vrest, vall, nbits, cov.vuncovered);
+}
+
+
+// one address only, the ROM isn't generated
+int Parser::Lookup(int naddr, lookup_t& res) {
+    if ((naddr < 0) || (naddr > bitmask(inputs_nbits + 1))) {
+        error("Address out of range (0.." << bitmask(inputs_nbits + 1) << ")");
+        return -1;
+    }
+
+    const int *nwords = Expect(naddr, &res.nop);
+    res.naddr = naddr;
+    res.sop = (res.nop >= 0) ? optable.snames[res.nop] : "";
+    res.vnwords.assign(nwords, nwords + signals_nchips + 1);
+
+    res.vinputs.clear();
+    for (auto& in : vinputs) {
+        field_t f = {in.sname, -1, (naddr >> in.nstart) & bitmask(in.nnum)};
+        res.vinputs.push_back(f);
+    }
+    res.vsignals.clear();
+    for (auto& sig : vsignals) {
+        field_t f = {sig.sname, sig.nchip, (res.vnwords[sig.nchip] >> sig.nstart) & bitmask(sig.nnum)};
+        res.vsignals.push_back(f);
     }
-    
-    silent("Generating... done (" << nmatches << " matches)");
     return 1;
 }
@@ -22,10 +22,18 @@
 #define PARSER_H_
 
 
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "globals.h"
+#include "cube.h"
+#include "arena.h"
+#include "lexer.h"
+#include "matcher.h"
+#include "symtab.h"
 
 
 using namespace std;
@@ -51,27 +59,166 @@ typedef struct signals {
 
 typedef struct defs {
     string sname;       // identifier
-    string scontent;    // replacement
+    string scontent;    // replacement (as written)
+    int ntype;          // TOK_NUMBER, TOK_DONTCARE ('x') or TOK_ALL ('*')
+    long long nval;     // evaluated value (TOK_NUMBER)
 } defs_t;
 
 
+// changes of the signal words: word = (word & vnand[chip]) | vnor[chip]
+typedef struct patch {
+    vector<int> vnand;  // bits to keep (one for each chip)
+    vector<int> vnor;   // bits to set (one for each chip)
+} patch_t;
+
+
+// compiled content of a macro
+typedef struct expansion {
+    patch_t patch;          // changes of the signal words
+    vector<size_t> vndeps;  // definitions used (index in vdefs)
+} expansion_t;
+
+
 typedef struct macros {
     string sname;       // identifier
-    string scontent;    // replacement
+    vector<string> vsparams;    // names of the parameters
+    size_t nfirst;      // first line of the content (index in ctx.vlines)
+    size_t nlast;       // line with the closing '}'
+    size_t ndefs;       // number of definitions visible to the macro
+    size_t nmacros;     // number of macros visible to the macro (defined before)
+    expansion_t exp;    // compiled content (no parameters)
+    // compiled content for each used argument tuple (with parameters)
+    mutable map<vector<long long>, expansion_t> mexpansions;
 } macros_t;
 
 
+// what an expression or a list of signals can see
+typedef struct scope {
+    size_t ndefs;               // number of visible definitions
+    size_t nmacros;             // number of visible macros
+    const macros_t *pmacro;     // macro being expanded (for the parameters) or NULL
+    const long long *nargs;     // values of its parameters
+    vector<size_t> *pdeps;      // collects the used definitions (or NULL)
+} scope_t;
+
+
 typedef struct ops {
-    int nival;              // value of all inputs
-    int nimask;             // used bits of all inputs
+    vector<cube_t> vcubes;  // matching values of all inputs
     vector<int> vnsignals;  // value of signals (one for each chip)
     string sname;           // name (optional for debugging)
+    vector<size_t> vndeps;  // definitions the op depends on (also via macros and defaults)
 } ops_t;
 
 
+// all parsed ops, struct of arrays (allocated in the arena of the parser)
+typedef struct optable {
+    int nops;           // number of ops
+    int nchips;         // number of signal words per op
+    int ncubes;         // number of input cubes (one or more per op, in order of the ops)
+    int *nival;         // value of all inputs [ncubes]
+    int *nimask;        // used bits of all inputs [ncubes]
+    int *nop;           // op of the cube [ncubes]
+    int *nsignals;      // signal words [nops * nchips], row major
+    const char **snames;// names [nops]
+} optable_t;
+
+
+// what an (interned) identifier refers to, string::npos if nothing
+typedef struct syms {
+    size_t ninput;      // index in vinputs
+    size_t nsignal;     // index in vsignals
+    size_t ndefine;     // index in vdefs
+    size_t nmacro;      // index in vmacros
+} syms_t;
+
+
+// result of a compile: the ROM contents and the symbol tables
+typedef struct image {
+    int naddrbits;              // number of address bits (all inputs)
+    int nchips;                 // number of chips (signal words per address)
+    int nfirst;                 // address of the first word (only a range generated)
+    int nwords;                 // number of words per chip
+    int nwordbits;              // number of bits per word
+    vector<int> vnwords;        // contents [nchips * nwords], one row per chip
+    vector<int> vndefaults;     // default signal words (one for each chip)
+    vector<inputs_t>  vinputs;
+    vector<signals_t> vsignals;
+    vector<defs_t>    vdefs;    // (constants)
+    vector<string>    vsops;    // names of the ops
+    vector<unsigned long long> vnsources;   // hash of what the source gives each chip (see Parser::Hash)
+    unsigned long long nsource; // hash of the whole source (see Parser::SourceHash)
+    vector<bool> vbchips;       // chips generated (the others are not written)
+} image_t;
+
+
+// value of an input or signal (lookup)
+typedef struct field {
+    string sname;       // identifier
+    int nchip;          // chip of a signal (-1 for inputs)
+    int nval;           // value
+} field_t;
+
+
+// what one address of the ROM gives (without generating all of it)
+typedef struct lookup {
+    int naddr;                  // address
+    int nop;                    // matching op (-1 = none, default signals)
+    string sop;                 // name of the op
+    vector<int> vnwords;        // signal word of each chip
+    vector<field_t> vinputs;    // the address split into the inputs
+    vector<field_t> vsignals;   // the words split into the signals
+} lookup_t;
+
+
+// what an op gets of the input space (see Parser::Coverage)
+typedef struct opcover {
+    long long nowned;       // addresses the op wins
+    long long nmatched;     // addresses its inputs match
+    vector<int> vnshadows;  // earlier ops matching some of them (the first COVERAGE_SHADOWS)
+} opcover_t;
+
+
+// the input space split up between the ops (computed on the cubes, no addresses)
+typedef struct coverage {
+    int naddrbits;              // number of address bits
+    vector<opcover_t> vops;     // one for each op
+    long long nuncovered;       // addresses left to the defaults
+    vector<cube_t> vuncovered;  // the same as few cubes
+} coverage_t;
+
+
+// #op block waiting to be parsed
+typedef struct opjob {
+    size_t nline;       // line of the #op (index in ctx.vlines)
+    size_t ndefs;       // number of definitions visible to the op
+    size_t nmacros;     // number of macros visible to the op
+    size_t nlast;       // line with the closing '}'
+} opjob_t;
+
+
+// ops are parsed in chunks, each thread should get a few of them
+#define OPS_PER_CHUNK  64
+#define OPS_PER_THREAD 512
+
+// earlier ops named for an op that doesn't win all of its addresses
+#define COVERAGE_SHADOWS 3
+
+// highest input bit: 2^30 addresses, so the counts and the last address + 1 still fit in an int
+#define INPUTS_MAX_BIT 29
+
+// addresses generated in one go (one span of the trace, the progress is checked after each)
+#define GENERATE_BLOCK 65536
+
+// progress of Build() (config p): first line after, then every ... seconds
+#define PROGRESS_DELAY    2.0
+#define PROGRESS_INTERVAL 0.5
+
+
 class Parser
 {
-    // just an iterator to the current line of g_vlines
+    context_t& ctx;
+
+    // just an iterator to the current line of ctx.vlines
     vector<mcLines>::iterator cur_line;
 
     // internal database
@@ -79,29 +226,102 @@ class Parser
     vector<signals_t> vsignals;
     vector<defs_t>    vdefs;
     vector<macros_t>  vmacros;
-    vector<ops_t>     vops;
+    vector<ops_t>     vops;     // while parsing, moved into optable
+    Arena             arena;
+    optable_t         optable;
+    Matcher           matcher;  // finds the op of an address (built with the optable)
     int signals_nchips;
     int signals_nbits;
     int inputs_nbits;
+    vector<int> vndefaults; // default signal words (one for each chip)
+    vector<opjob_t> vopjobs;  // queued #op blocks
+    bool bquiet;            // no error messages (while parsing in parallel)
+    mutex expansions_mutex; // guards macros_t::mexpansions
+    vector<size_t> vndefaults_deps; // definitions used in #defaults so far
+    vector<bool> vbchips;   // chips to generate (empty = all), the others keep the defaults
+
+    // variants: same source, other values of some definitions
+    const map<string, long long> *poverrides;   // -D name=value (or NULL)
+    const Parser *pbase;    // parsed without the overrides, its ops are reused (or NULL)
+    bool bkeepops;          // keep vops after parsing (base of variants)
+    bool breference;        // Build() with the naive loop over all cubes (no Matcher)
+    vector<char> vchanged;  // definitions with another value than in pbase
+    // watch mode: the last version of the source, its unchanged #op blocks are reused
+    const Parser *pprev;    // (or NULL)
+    bool bsameprev;         // only #op blocks differ from pprev
+    string snonops;         // all lines outside of #op blocks (kept ops only)
+    map<size_t, size_t> mopstarts;      // line of an #op -> size of snonops before it
+    map<string, size_t> mopblocks;      // text of each #op block (see _opKey) -> op
+    atomic<size_t> nreparsed;   // number of ops parsed again (variant)
+    atomic<long long> nlookups; // symbol lookups (--stats)
 
-    size_t _findSignal(const string& str);
-    size_t _findDefine(const string& str);
-    size_t _findMacro(const string& str);
+    // symbol table (indexed by the id of the interned identifier)
+    SymbolPool     symbols;
+    vector<syms_t> vsyms;
 
-    int _parseNum(size_t pos, size_t *next);
-    size_t _parseDelim(size_t pos, const char *delim);
-    string _parseName(size_t pos, size_t *next);
+    syms_t& _addSymbol(const string& str);
+    const syms_t* _findSymbol(const token_t& tok);
+    size_t _findSignal(const token_t& tok);
+    size_t _findDefine(const token_t& tok);
+    size_t _findMacro(const token_t& tok);
+
+    int _unterminated();
+    int _parseNum(Lexer& lex, long long *val, const char *msg);
+    int _parseDelim(Lexer& lex, const char *delim);
+    int _parseName(Lexer& lex, token_t *tok, const char *msg);
+    int _parseInputValues(Lexer& lex, const scope_t& scope, size_t ninput, vector<range_t>& vranges);
+    int _parseBits(Lexer& lex, int *nstart, int *nend, int nmax, const char *swhy = "");
+    int _evalExpr(Lexer& lex, const scope_t& scope, long long *val);
+    int _evalBinary(Lexer& lex, const scope_t& scope, int nprec, long long *val);
+    int _evalUnary(Lexer& lex, const scope_t& scope, long long *val);
+    int _parseSignalList(Lexer& lex, patch_t& patch, const scope_t& scope);
+    int _compileMacro(const macros_t& macro, const long long *nargs, expansion_t& exp);
+    const expansion_t* _expandMacro(const macros_t& macro, const vector<long long>& vnargs);
+    void _updateDefaults();
+    bool _chip(int nchip) const { return vbchips.empty() || (((size_t)nchip < vbchips.size()) && vbchips[nchip]); }
 
     int ParseInputs();
     int ParseSignals();
     int ParseDefines();
     int ParseMacros();
     int ParseDefaults();
-    int ParseOpcode();
+    int ParseOpcode(vector<mcLines>::iterator& cur_line, const opjob_t& job, ops_t& new_op);
+    void _splitOps();
+    string _opKey(const opjob_t& job) const;
+    bool _reuseOp(size_t njob, ops_t& op);
+    int _flushOps();
+    void _buildOpTable();
+    void _imageSymbols(image_t& image) const;
 
 public:
+    Parser(context_t& context);
+
+    void SetOverrides(const map<string, long long> *poverrides);
+    void SetBase(const Parser *pbase);
+    void SetPrevious(const Parser *pprev);
+    void KeepOps();
+    void SelectChips(const vector<bool>& vbchips);
+    void SetReference(bool breference);
+
     int Parse();
-    int Generate(const string& out_file);
+    int Build(image_t& image, int nfirst = 0, int nlast = -1);
+    bool Changes(const Parser& prev, vector<cube_t>& vcubes) const;
+    long long Rebuild(image_t& image, const vector<cube_t>& vcubes, vector<bool>& vbchanged);
+    int Lookup(int naddr, lookup_t& res);
+    const int* Expect(int naddr, int *pnop, long long *pnprobes = NULL) const;
+    const int* ExpectReference(int naddr, int *pnop) const;
+    const int* Words(int nop) const;
+    unsigned long long Hash(int nchip) const;
+    unsigned long long SourceHash() const;
+    void Regions(vector<cube_t>& vcubes, vector<int>& vnops) const;
+    void Coverage(coverage_t& cov) const;
+
+    // after parsing
+    int AddrBits() const { return inputs_nbits + 1; }
+    int Chips() const { return signals_nchips + 1; }
+    int WordBits() const { return signals_nbits + 1; }
+    const vector<signals_t>& Signals() const { return vsignals; }
+    const char* OpName(int nop) const { return (nop >= 0) ? optable.snames[nop] : "(defaults)"; }
 };
 
 
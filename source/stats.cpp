@@ -0,0 +1,188 @@
+/*
+ *
+ *    stats.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+#include "json.h"
+#include "stats.h"
+
+
+double cpu_time() {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+
+// read/write syscalls of the process so far (-1 if unknown)
+static void syscalls(long long& nread, long long& nwrite) {
+    nread = nwrite = -1;
+#ifdef __linux__
+    FILE *pfile = fopen("/proc/self/io", "r");
+    char buf[128];
+    if (pfile == NULL)
+        return;
+    while (fgets(buf, sizeof(buf), pfile)) {
+        if (strncmp(buf, "syscr: ", 7) == 0)
+            nread = atoll(buf + 7);
+        if (strncmp(buf, "syscw: ", 7) == 0)
+            nwrite = atoll(buf + 7);
+    }
+    fclose(pfile);
+#endif
+}
+
+
+// peak resident set size (KB, -1 if unknown)
+static long long peak_rss() {
+#ifdef __unix__
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+#ifdef __APPLE__
+        return ru.ru_maxrss / 1024;
+#else
+        return ru.ru_maxrss;
+#endif
+#endif
+    return -1;
+}
+
+
+Stats::Stats() {
+    Reset();
+}
+
+
+// start again (next run in watch mode)
+void Stats::Reset() {
+    lock_guard<mutex> lock(mtx);
+    vphases.clear();
+    vcounters.clear();
+    tstart = chrono::steady_clock::now();
+    dcpustart = cpu_time();
+    syscalls(nsyscr, nsyscw);
+}
+
+
+void Stats::AddTime(const char *sname, double dwall, double dcpu) {
+    lock_guard<mutex> lock(mtx);
+    for (auto& p : vphases) {
+        if (p.sname == sname) {
+            p.dwall += dwall;
+            p.dcpu += dcpu;
+            ++p.ncalls;
+            return;
+        }
+    }
+    phase_t p = {sname, dwall, dcpu, 1};
+    vphases.push_back(p);
+}
+
+
+void Stats::Add(const char *sname, long long n) {
+    lock_guard<mutex> lock(mtx);
+    for (auto& c : vcounters) {
+        if (c.first == sname) {
+            c.second += n;
+            return;
+        }
+    }
+    vcounters.push_back(make_pair(string(sname), n));
+}
+
+
+vector<phase_t> Stats::Phases() {
+    lock_guard<mutex> lock(mtx);
+    return vphases;
+}
+
+
+long long Stats::Counter(const char *sname) {
+    lock_guard<mutex> lock(mtx);
+    for (auto& c : vcounters) {
+        if (c.first == sname)
+            return c.second;
+    }
+    return 0;
+}
+
+
+void Stats::Print(ostream& os) {
+    lock_guard<mutex> lock(mtx);
+    chrono::duration<double> d = chrono::steady_clock::now() - tstart;
+    long long nr, nw;
+    char buf[160];
+
+    syscalls(nr, nw);
+    os << "Statistics:" << endl;
+    snprintf(buf, sizeof(buf), "  %-28s %10s %10s %8s", "phase", "wall ms", "cpu ms", "calls");
+    os << buf << endl;
+    for (auto& p : vphases) {
+        snprintf(buf, sizeof(buf), "  %-28s %10.3f %10.3f %8lld", p.sname.c_str(), p.dwall * 1e3, p.dcpu * 1e3, p.ncalls);
+        os << buf << endl;
+    }
+    snprintf(buf, sizeof(buf), "  %-28s %10.3f %10.3f", "total", d.count() * 1e3, (cpu_time() - dcpustart) * 1e3);
+    os << buf << endl;
+    for (auto& c : vcounters) {
+        snprintf(buf, sizeof(buf), "  %-28s %10lld", c.first.c_str(), c.second);
+        os << buf << endl;
+    }
+    if (nr >= 0) {
+        snprintf(buf, sizeof(buf), "  %-28s %10lld\n  %-28s %10lld", "read syscalls", nr - nsyscr, "write syscalls", nw - nsyscw);
+        os << buf << endl;
+    }
+    snprintf(buf, sizeof(buf), "  %-28s %10lld", "peak RSS (KB)", peak_rss());
+    os << buf << endl;
+}
+
+
+// the same as one JSON object (on one line)
+void Stats::PrintJson(ostream& os) {
+    lock_guard<mutex> lock(mtx);
+    chrono::duration<double> d = chrono::steady_clock::now() - tstart;
+    long long nr, nw;
+    char buf[64];
+
+    syscalls(nr, nw);
+    os << "{\"phases\":[";
+    for (size_t n = 0; n < vphases.size(); ++n) {
+        const phase_t& p = vphases[n];
+        snprintf(buf, sizeof(buf), "%.6f,\"cpu_s\":%.6f", p.dwall, p.dcpu);
+        os << (n ? "," : "") << "{\"name\":\"" << json_escape(p.sname) << "\",\"wall_s\":" << buf
+           << ",\"calls\":" << p.ncalls << "}";
+    }
+    snprintf(buf, sizeof(buf), "%.6f,\"cpu_s\":%.6f", d.count(), cpu_time() - dcpustart);
+    os << "],\"total\":{\"wall_s\":" << buf << "},\"counters\":{";
+    for (size_t n = 0; n < vcounters.size(); ++n)
+        os << (n ? "," : "") << "\"" << json_escape(vcounters[n].first) << "\":" << vcounters[n].second;
+    if (nr >= 0)
+        os << (vcounters.empty() ? "" : ",") << "\"read syscalls\":" << nr - nsyscr << ",\"write syscalls\":" << nw - nsyscw;
+    os << "},\"peak_rss_kb\":" << peak_rss() << "}" << endl;
+}
@@ -0,0 +1,102 @@
+/*
+ *
+ *    stats.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+
+// time spent in a phase (added up over all calls)
+typedef struct phase {
+    string sname;
+    double dwall;       // wall clock time (s)
+    double dcpu;        // CPU time of the process (s, all threads)
+    long long ncalls;
+} phase_t;
+
+
+// what a run did (--stats): time of each phase, counters and the memory used
+//  the phases and counters are listed in the order they were first used,
+//  several threads can add to it
+class Stats
+{
+    vector<phase_t> vphases;
+    vector<pair<string, long long> > vcounters;
+    chrono::steady_clock::time_point tstart;
+    double dcpustart;
+    long long nsyscr, nsyscw;   // read/write syscalls at the start
+    mutex mtx;
+
+public:
+    Stats();
+
+    void Reset();
+    void AddTime(const char *sname, double dwall, double dcpu);
+    void Add(const char *sname, long long n);
+
+    void Print(ostream& os);
+    void PrintJson(ostream& os);
+
+    // what was collected so far (counter is 0 if never added)
+    vector<phase_t> Phases();
+    long long Counter(const char *sname);
+};
+
+
+// CPU time used by the process so far (s)
+double cpu_time();
+
+
+// adds the time until the end of the scope to a phase (does nothing without stats)
+class StatsTimer
+{
+    Stats *pstats;
+    const char *sname;
+    chrono::steady_clock::time_point tstart;
+    double dcpustart;
+
+public:
+    StatsTimer(Stats *pstats, const char *sname) : pstats(pstats), sname(sname) {
+        if (pstats) {
+            tstart = chrono::steady_clock::now();
+            dcpustart = cpu_time();
+        }
+    }
+    ~StatsTimer() {
+        if (pstats) {
+            chrono::duration<double> d = chrono::steady_clock::now() - tstart;
+            pstats->AddTime(sname, d.count(), cpu_time() - dcpustart);
+        }
+    }
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+};
+
+
+#endif /* STATS_H_ */
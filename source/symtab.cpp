@@ -0,0 +1,88 @@
+/*
+ *
+ *    symtab.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstring>
+
+#include "symtab.h"
+
+
+#define SYMTAB_INITIAL_SIZE 256
+
+
+SymbolPool::SymbolPool() {
+    vntable.assign(SYMTAB_INITIAL_SIZE, 0);
+    nmask = SYMTAB_INITIAL_SIZE - 1;
+}
+
+
+// FNV-1a
+unsigned SymbolPool::_hash(const char *s, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t x = 0; x < len; ++x) {
+        h ^= (unsigned char)s[x];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+// double the table size and reinsert all ids
+void SymbolPool::_grow() {
+    vntable.assign(vntable.size() * 2, 0);
+    nmask = vntable.size() - 1;
+    for (size_t id = 0; id < vsnames.size(); ++id) {
+        unsigned n = vnhashes[id] & nmask;
+        while (vntable[n] != 0)
+            n = (n + 1) & nmask;
+        vntable[n] = id + 1;
+    }
+}
+
+
+int SymbolPool::Find(const char *s, size_t len) const {
+    unsigned n = _hash(s, len) & nmask;
+    while (vntable[n] != 0) {
+        const string& sn = vsnames[vntable[n] - 1];
+        if ((sn.size() == len) && (memcmp(sn.data(), s, len) == 0))
+            return vntable[n] - 1;
+        n = (n + 1) & nmask;
+    }
+    return -1;
+}
+
+
+int SymbolPool::Intern(const char *s, size_t len) {
+    unsigned h = _hash(s, len);
+    unsigned n = h & nmask;
+    while (vntable[n] != 0) {
+        const string& sn = vsnames[vntable[n] - 1];
+        if ((sn.size() == len) && (memcmp(sn.data(), s, len) == 0))
+            return vntable[n] - 1;
+        n = (n + 1) & nmask;
+    }
+    // new identifier
+    vsnames.push_back(string(s, len));
+    vnhashes.push_back(h);
+    vntable[n] = vsnames.size();
+    // keep the load factor below 50%
+    if (vsnames.size() * 2 > vntable.size())
+        _grow();
+    return vsnames.size() - 1;
+}
@@ -0,0 +1,59 @@
+/*
+ *
+ *    symtab.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SYMTAB_H_
+#define SYMTAB_H_
+
+
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+
+// interns identifiers into dense ids (0..size()-1)
+//  the lookup is an open addressing hash table with linear probing
+class SymbolPool
+{
+    vector<string>   vsnames;   // name of each id
+    vector<unsigned> vnhashes;  // hash of each id (for rehashing)
+    vector<int>      vntable;   // hash table: id+1 (0 = empty slot)
+    unsigned         nmask;     // size of vntable - 1
+
+    static unsigned _hash(const char *s, size_t len);
+    void _grow();
+
+public:
+    SymbolPool();
+
+    // returns the id of the identifier or -1 if not interned
+    int Find(const char *s, size_t len) const;
+    int Find(const string& s) const { return Find(s.data(), s.size()); }
+    // returns the id of the identifier (adds it if needed)
+    int Intern(const char *s, size_t len);
+    int Intern(const string& s) { return Intern(s.data(), s.size()); }
+
+    const string& Name(int id) const { return vsnames[id]; }
+    size_t size() const { return vsnames.size(); }
+};
+
+
+#endif /* SYMTAB_H_ */
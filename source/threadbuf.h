@@ -0,0 +1,98 @@
+/*
+ *
+ *    threadbuf.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef THREADBUF_H_
+#define THREADBUF_H_
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+using namespace std;
+
+
+// one buffer of T for each thread writing to an object (Log, Trace)
+//  a thread remembers the object it used last (by its serial number) and its buffer
+//  there, so it finds the buffer without locking as long as it sticks to one object
+template <typename T>
+class ThreadBuffers
+{
+    vector<pair<thread::id, unique_ptr<T> > > vbuffers;    // in order of the first use
+    unsigned nserial;   // tells the buffers of this object from others (and dropped ones)
+    mutex mtx;
+
+    static unsigned _nextSerial() {
+        static atomic<unsigned> nnext(1);
+        return nnext.fetch_add(1);
+    }
+    static unsigned& _threadSerial() {
+        static thread_local unsigned nthreadserial = 0;
+        return nthreadserial;
+    }
+    static T*& _threadBuffer() {
+        static thread_local T *pthreadbuffer = NULL;
+        return pthreadbuffer;
+    }
+
+public:
+    ThreadBuffers() : nserial(_nextSerial()) {}
+    ThreadBuffers(const ThreadBuffers&) = delete;
+    ThreadBuffers& operator=(const ThreadBuffers&) = delete;
+
+    // buffer of the calling thread (created at its first use)
+    T* Get() {
+        if (_threadSerial() != nserial) {
+            lock_guard<mutex> lock(mtx);
+            thread::id tid = this_thread::get_id();
+            T *pbuf = NULL;
+            for (auto& b : vbuffers) {
+                if (b.first == tid)
+                    pbuf = b.second.get();
+            }
+            if (pbuf == NULL) {
+                vbuffers.push_back(make_pair(tid, unique_ptr<T>(new T())));
+                pbuf = vbuffers.back().second.get();
+            }
+            _threadBuffer() = pbuf;
+            _threadSerial() = nserial;
+        }
+        return _threadBuffer();
+    }
+
+    // drop all buffers (no other thread may write meanwhile)
+    void Clear() {
+        lock_guard<mutex> lock(mtx);
+        vbuffers.clear();
+        nserial = _nextSerial();
+    }
+
+    // all buffers, only with Mutex() locked (Get() adds buffers under it)
+    size_t size() const { return vbuffers.size(); }
+    T& operator[](size_t n) { return *vbuffers[n].second; }
+    mutex& Mutex() { return mtx; }
+};
+
+
+#endif /* THREADBUF_H_ */
@@ -0,0 +1,100 @@
+/*
+ *
+ *    trace.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+
+#include "json.h"
+#include "trace.h"
+
+
+Trace::Trace() {
+    Reset();
+}
+
+
+// drop all spans and start again (next run in watch mode), no span may be open
+void Trace::Reset() {
+    buffers.Clear();
+    tstart = chrono::steady_clock::now();
+}
+
+
+// us since the start
+long long Trace::Now() const {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - tstart).count();
+}
+
+
+void Trace::Add(const char *scat, const char *sname, long long nstart, long long nend, string& sargs) {
+    trace_event_t ev = {scat, sname, nstart, nend - nstart, string()};
+    ev.sargs.swap(sargs);
+    buffers.Get()->vevents.push_back(move(ev));
+}
+
+
+// all threads with spans must have finished
+int Trace::Write(const string& sfile) {
+    lock_guard<mutex> lock(buffers.Mutex());
+    FILE *pfile = fopen(sfile.c_str(), "w");
+
+    if (pfile == NULL)
+        return -1;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", pfile);
+    fputs("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"mcasm\"}}", pfile);
+    for (size_t n = 0; n < buffers.size(); ++n) {
+        int ntid = (int)n + 1;
+        fprintf(pfile, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                ntid, ntid);
+        for (auto& ev : buffers[n].vevents) {
+            fprintf(pfile, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                    ev.scat, ev.sname, ntid, ev.nstart, ev.ndur);
+            if (!ev.sargs.empty())
+                fprintf(pfile, ",\"args\":{%s}", ev.sargs.c_str());
+            fputs("}", pfile);
+        }
+    }
+    fputs("\n]}\n", pfile);
+    fclose(pfile);
+    return 1;
+}
+
+
+void TraceSpan::Arg(const char *skey, const char *sval) {
+    if (ptrace)
+        Arg(skey, string(sval));
+}
+
+
+void TraceSpan::Arg(const char *skey, const string& sval) {
+    if (!ptrace)
+        return;
+    if (!sargs.empty())
+        sargs += ',';
+    sargs += "\"" + string(skey) + "\":\"" + json_escape(sval) + "\"";
+}
+
+
+void TraceSpan::Arg(const char *skey, long long nval) {
+    if (!ptrace)
+        return;
+    if (!sargs.empty())
+        sargs += ',';
+    sargs += "\"" + string(skey) + "\":" + to_string(nval);
+}
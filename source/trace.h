@@ -0,0 +1,98 @@
+/*
+ *
+ *    trace.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "threadbuf.h"
+
+
+using namespace std;
+
+
+// a finished span
+typedef struct trace_event {
+    const char *scat;   // category (static string)
+    const char *sname;  // name (static string)
+    long long nstart;   // us since the start of the trace
+    long long ndur;     // us
+    string sargs;       // arguments (JSON members, may be empty)
+} trace_event_t;
+
+
+// spans of all threads for chrome://tracing or Perfetto (--trace)
+//  each thread writes into its own buffer, no locking while tracing
+class Trace
+{
+    typedef struct buffer {
+        vector<trace_event_t> vevents;
+    } buffer_t;
+
+    chrono::steady_clock::time_point tstart;
+    ThreadBuffers<buffer_t> buffers;    // one for each thread
+
+public:
+    Trace();
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    void Reset();
+    long long Now() const;
+    void Add(const char *scat, const char *sname, long long nstart, long long nend, string& sargs);
+    // Chrome trace event JSON
+    int Write(const string& sfile);
+};
+
+
+// a span from here to the end of the scope (does nothing without a trace)
+class TraceSpan
+{
+    Trace *ptrace;
+    const char *scat;
+    const char *sname;
+    long long nstart;
+    string sargs;
+
+public:
+    TraceSpan(Trace *ptrace, const char *scat, const char *sname) : ptrace(ptrace), scat(scat), sname(sname) {
+        if (ptrace)
+            nstart = ptrace->Now();
+    }
+    ~TraceSpan() {
+        if (ptrace)
+            ptrace->Add(scat, sname, nstart, ptrace->Now(), sargs);
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    // arguments shown with the span
+    void Arg(const char *skey, const char *sval);
+    void Arg(const char *skey, const string& sval);
+    void Arg(const char *skey, long long nval);
+    bool On() const { return ptrace != NULL; }
+};
+
+
+#endif /* TRACE_H_ */
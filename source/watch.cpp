@@ -0,0 +1,132 @@
+/*
+ *
+ *    watch.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <algorithm>
+#include <string>
+
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+// some message macros
+#define debug(out) log_to(&log, LOG_LOADER, LOG_DEBUG, out)
+#define error(out) log_to(&log, LOG_LOADER, LOG_ERROR, "ERROR: " << out)
+
+
+#ifdef __linux__
+// time to wait for more events after the first change (editors write in bursts)
+#define WATCH_SETTLE_MS 50
+
+
+int watch_files(const vector<string>& vfiles, Log& log, vector<string>& vschanged) {
+    int fd;
+    vector<int> vwd;        // watch descriptors (one per directory)
+    vector<string> vdir;    // directory of each watch descriptor
+
+    if ((fd = inotify_init1(IN_CLOEXEC)) == -1) {
+        error("Unable to initialize inotify");
+        return -1;
+    }
+
+    // watch the directories instead of the files, most editors replace
+    // the file on save (rename) and a watch on the file would get lost
+    for (auto f : vfiles) {
+        size_t p = f.find_last_of('/');
+        string sdir = (p == string::npos) ? "." : f.substr(0, p + 1);
+        bool found = false;
+        for (auto d : vdir) {
+            if (d == sdir) {
+                found = true;
+                break;
+            }
+        }
+        if (found)
+            continue;
+        int wd = inotify_add_watch(fd, sdir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd == -1) {
+            error("Unable to watch directory '" << sdir << "'");
+            close(fd);
+            return -1;
+        }
+        vwd.push_back(wd);
+        vdir.push_back(sdir);
+        debug("Watching directory: '" << sdir << "'");
+    }
+
+    // wait for a change of one of our files
+    vschanged.clear();
+    log.Flush();
+    while (true) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        // block until the first change, then just collect the rest of the burst
+        int n = poll(&pfd, 1, vschanged.empty() ? -1 : WATCH_SETTLE_MS);
+        if (n == -1) {
+            error("Waiting for file changes failed");
+            close(fd);
+            return -1;
+        }
+        if (n == 0)
+            break;
+
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            error("Reading file events failed");
+            close(fd);
+            return -1;
+        }
+        for (char *ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+            if (ev->len == 0)
+                continue;
+            // map (directory, name) back to one of our files
+            for (size_t x = 0; x < vwd.size(); ++x) {
+                if (vwd[x] != ev->wd)
+                    continue;
+                string sfile = (vdir[x] == ".") ? ev->name : vdir[x] + ev->name;
+                for (auto f : vfiles) {
+                    if ((f == sfile) && (find(vschanged.begin(), vschanged.end(), f) == vschanged.end())) {
+                        debug("File changed: '" << f << "'");
+                        vschanged.push_back(f);
+                    }
+                }
+            }
+        }
+    }
+
+    close(fd);
+    log.Flush();
+    return 1;
+}
+
+
+#else
+int watch_files(const vector<string>& vfiles, Log& log, vector<string>& vschanged) {
+    (void)vfiles;
+    vschanged.clear();
+    error("Watch mode is not supported on this platform");
+    return -1;
+}
+#endif
@@ -0,0 +1,42 @@
+/*
+ *
+ *    watch.h - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WATCH_H_
+#define WATCH_H_
+
+
+#include <string>
+#include <vector>
+
+#include "globals.h"
+#include "log.h"
+
+
+using namespace std;
+
+
+// blocks until one of the given files was written (or replaced)
+//  vschanged gets the changed files (all written in one go)
+//  returns -1 on error (or if not supported), 1 if a file has changed
+//  messages go to the loader subsystem of log (what is watched and what has changed: debug)
+int watch_files(const vector<string>& vfiles, Log& log, vector<string>& vschanged);
+
+
+#endif /* WATCH_H_ */
@@ -0,0 +1,414 @@
+/*
+ *
+ *    bench.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mcasm.h"
+#include "stats.h"
+
+using namespace std;
+
+
+/*
+ * mcbench - times load, parse and generate on synthetic sources
+ *
+ *  the sources are generated in memory (Mcasm::SetFile), the same parameters
+ *  and seed always give the same source, so results of different commits
+ *  can be compared
+ */
+
+
+// what the synthetic source looks like
+typedef struct genparams {
+	int nbits;          // input bits (8..28)
+	int nops;           // number of #op blocks
+	int nchips;         // number of chips (16 signal bits each)
+	int nmacros;        // percentage of ops using macros
+	int nincludes;      // number of files the ops are spread over (0 = all in the main file)
+	string smasks;      // dense, sparse, mixed or ranges
+	unsigned nseed;
+} genparams_t;
+
+
+// inputs are split into fields of this many bits
+#define FIELD_BITS 4
+// constants K0.. (values of a whole field)
+#define NUM_CONSTANTS 64
+// macros M0.. (plain) and P0..(v) (with a parameter)
+#define NUM_MACROS 8
+
+
+// deterministic on all platforms (the distributions of <random> are not)
+class Rand
+{
+	mt19937 gen;
+
+public:
+	Rand(unsigned nseed) : gen(nseed) {}
+	// 0..n-1
+	int Next(int n) { return (int)(gen() % (unsigned)n); }
+	// true with nper percent
+	bool Chance(int nper) { return Next(100) < nper; }
+};
+
+
+// value of one input field of an op
+string gen_field(Rand& rnd, int nwidth, int nxper, const string& smasks) {
+	int nmax = 1 << nwidth;
+	char buf[32];
+
+	if (rnd.Chance(nxper))
+		return "x";
+	if (smasks == "ranges") {
+		int a = rnd.Next(nmax), b = rnd.Next(nmax);
+		if (a > b)
+			swap(a, b);
+		switch (rnd.Next(4)) {
+		case 0:
+			snprintf(buf, sizeof(buf), "%d..%d", a, b);
+			return buf;
+		case 1:
+			snprintf(buf, sizeof(buf), "{%d, %d..%d}", rnd.Next(nmax), a, b);
+			return buf;
+		}
+	}
+	if ((nwidth == FIELD_BITS) && rnd.Chance(25)) {
+		snprintf(buf, sizeof(buf), "K%d", rnd.Next(NUM_CONSTANTS));
+		return buf;
+	}
+	snprintf(buf, sizeof(buf), "0x%X", rnd.Next(nmax));
+	return buf;
+}
+
+
+// one signal assignment of a random chip
+string gen_signal(Rand& rnd, int nchips) {
+	int c = rnd.Next(nchips);
+	char buf[32];
+
+	switch (rnd.Next(4)) {
+	case 0:
+		snprintf(buf, sizeof(buf), "a%d=%d", c, rnd.Next(256));
+		break;
+	case 1:
+		snprintf(buf, sizeof(buf), "b%d=%d", c, rnd.Next(16));
+		break;
+	case 2:
+		snprintf(buf, sizeof(buf), "e%d", c);
+		break;
+	default:
+		snprintf(buf, sizeof(buf), "!d%d", c);
+		break;
+	}
+	return buf;
+}
+
+
+// all files of the source, the main file is "bench.mc"
+void generate(const genparams_t& gp, map<string, string>& mfiles) {
+	Rand rnd(gp.nseed);
+	ostringstream main;
+	vector<ostringstream> vops(max(1, gp.nincludes));
+	int nfields = (gp.nbits + FIELD_BITS - 1) / FIELD_BITS;
+
+	// inputs: fields of FIELD_BITS (the last one may be smaller)
+	main << "#inputs {\n";
+	for (int f = 0; f < nfields; ++f) {
+		int nend = min(gp.nbits, (f + 1) * FIELD_BITS) - 1;
+		main << " " << f * FIELD_BITS << ".." << nend << " = f" << f << "\n";
+	}
+	main << "}\n";
+
+	// signals: 16 bits on each chip
+	main << "#signals {\n";
+	for (int c = 0; c < gp.nchips; ++c) {
+		main << " " << c << ":0..7 = a" << c << "\n";
+		main << " " << c << ":8..11 = b" << c << "\n";
+		main << " " << c << ":12 = e" << c << "\n";
+		main << " " << c << ":13..15 = d" << c << "\n";
+	}
+	main << "}\n#defaults {\n";
+	for (int c = 0; c < gp.nchips; ++c)
+		main << " d" << c << " = 5\n";
+	main << "}\n";
+
+	// constants and macros
+	for (int k = 0; k < NUM_CONSTANTS; ++k)
+		main << "#define K" << k << " (" << rnd.Next(1 << FIELD_BITS) << ")\n";
+	for (int m = 0; m < NUM_MACROS; ++m) {
+		main << "#define M" << m << " {\n " << gen_signal(rnd, gp.nchips) << ", " << gen_signal(rnd, gp.nchips) << "\n}\n";
+		main << "#define P" << m << "(v) {\n a" << rnd.Next(gp.nchips) << " = v, b" << rnd.Next(gp.nchips) << " = v & 15\n}\n";
+	}
+
+	// ops, spread over the include files in blocks
+	for (int n = 0; n < gp.nops; ++n) {
+		ostringstream& os = vops[(long long)n * vops.size() / gp.nops];
+		int nxper = (gp.smasks == "dense") ? 10 : (gp.smasks == "sparse") ? 60 : (gp.smasks == "ranges") ? 20 : rnd.Next(100);
+
+		os << "#op(";
+		for (int f = 0; f < nfields; ++f) {
+			int nwidth = min(gp.nbits, (f + 1) * FIELD_BITS) - f * FIELD_BITS;
+			if ((f > 0) && rnd.Chance(nxper / 4)) {
+				os << ", *";
+				break;
+			}
+			os << (f ? ", " : "") << gen_field(rnd, nwidth, nxper, gp.smasks);
+		}
+		os << ") { op" << n << "\n " << gen_signal(rnd, gp.nchips);
+		for (int s = rnd.Next(3); s > 0; --s)
+			os << ", " << gen_signal(rnd, gp.nchips);
+		if (rnd.Chance(gp.nmacros)) {
+			if (rnd.Chance(50))
+				os << ", M" << rnd.Next(NUM_MACROS);
+			else
+				os << ", P" << rnd.Next(NUM_MACROS) << "(" << rnd.Next(256) << ")";
+		}
+		os << "\n}\n";
+	}
+
+	if (gp.nincludes == 0) {
+		main << vops[0].str();
+	} else {
+		for (int i = 0; i < gp.nincludes; ++i) {
+			string sname = "ops_" + to_string(i) + ".mc";
+			main << "#include \"" << sname << "\"\n";
+			mfiles[sname] = vops[i].str();
+		}
+	}
+	mfiles["bench.mc"] = main.str();
+}
+
+
+// name of a configuration (also used as the file prefix for --dump)
+string config_name(const genparams_t& gp) {
+	char buf[128];
+	snprintf(buf, sizeof(buf), "b%d_o%d_c%d_m%d_i%d_%s", gp.nbits, gp.nops, gp.nchips, gp.nmacros, gp.nincludes, gp.smasks.c_str());
+	return buf;
+}
+
+
+// times of one configuration (best of nreps runs)
+int run(const genparams_t& gp, int nreps, int nthreads, ostream& json) {
+	map<string, string> mfiles;
+	map<string, double> mbest;      // phase -> seconds
+	double dbest = 0;
+	long long nlines = 0, naddrs = 0, nbytes = 0;
+
+	generate(gp, mfiles);
+	for (auto& f : mfiles)
+		nbytes += f.second.size();
+
+	for (int r = 0; r < nreps; ++r) {
+		Mcasm mcasm;
+		Stats stats;
+		image_t image;
+
+		mcasm.Config().s = true;
+		if (nthreads > 0)
+			mcasm.Config().nthreads = nthreads;
+		mcasm.SetStats(&stats);
+		for (auto& f : mfiles)
+			mcasm.SetFile(f.first, f.second);
+		auto t0 = chrono::steady_clock::now();
+		if (mcasm.Compile("bench.mc", image) == -1) {
+			cerr << "ERROR: " << config_name(gp) << ": the generated source doesn't compile" << endl;
+			return -1;
+		}
+		chrono::duration<double> d = chrono::steady_clock::now() - t0;
+		if ((r == 0) || (d.count() < dbest))
+			dbest = d.count();
+		for (auto& p : stats.Phases()) {
+			auto it = mbest.find(p.sname);
+			if ((it == mbest.end()) || (p.dwall < it->second))
+				mbest[p.sname] = p.dwall;
+		}
+		nlines = stats.Counter("lines read");
+		naddrs = stats.Counter("addresses generated");
+	}
+
+	// phases added up by stage
+	double dload = 0, dparse = 0, dgen = 0;
+	for (auto& p : mbest) {
+		if (p.first.compare(0, 5, "load/") == 0)
+			dload += p.second;
+		else if (p.first.compare(0, 6, "parse/") == 0)
+			dparse += p.second;
+		else if (p.first == "generate")
+			dgen += p.second;
+	}
+
+	char buf[512];
+	snprintf(buf, sizeof(buf),
+			"{\"name\":\"%s\",\"bits\":%d,\"ops\":%d,\"chips\":%d,\"macros\":%d,\"includes\":%d,\"masks\":\"%s\",\"seed\":%u,"
+			"\"reps\":%d,\"bytes\":%lld,\"lines\":%lld,\"addresses\":%lld,"
+			"\"load_s\":%.6f,\"parse_s\":%.6f,\"generate_s\":%.6f,\"total_s\":%.6f,"
+			"\"lines_per_s\":%.0f,\"addresses_per_s\":%.0f,\"phases\":{",
+			config_name(gp).c_str(), gp.nbits, gp.nops, gp.nchips, gp.nmacros, gp.nincludes, gp.smasks.c_str(), gp.nseed,
+			nreps, nbytes, nlines, naddrs, dload, dparse, dgen, dbest,
+			(dload + dparse > 0) ? nlines / (dload + dparse) : 0.0, (dgen > 0) ? naddrs / dgen : 0.0);
+	json << buf;
+	bool bfirst = true;
+	for (auto& p : mbest) {
+		snprintf(buf, sizeof(buf), "%s\"%s\":%.6f", bfirst ? "" : ",", p.first.c_str(), p.second);
+		json << buf;
+		bfirst = false;
+	}
+	json << "}}";
+
+	fprintf(stderr, "%-40s load %8.3f ms  parse %8.3f ms  generate %8.3f ms  %10.0f lines/s  %12.0f addr/s\n",
+			config_name(gp).c_str(), dload * 1e3, dparse * 1e3, dgen * 1e3,
+			(dload + dparse > 0) ? nlines / (dload + dparse) : 0.0, (dgen > 0) ? naddrs / dgen : 0.0);
+	return 1;
+}
+
+
+void print_help() {
+	cout << "Usage: mcbench [options]" << endl;
+	cout << "Generates synthetic sources and times load, parse and generate" << endl;
+	cout << "Options:" << endl;
+	cout << "  --bits=[N]              Input bits, 8..28 (default: 16)" << endl;
+	cout << "  --ops=[N]               Number of ops (default: 1000)" << endl;
+	cout << "  --chips=[N]             Number of chips (default: 2)" << endl;
+	cout << "  --macros=[N]            Percentage of ops using macros (default: 20)" << endl;
+	cout << "  --includes=[N]          Spread the ops over N include files (default: 4)" << endl;
+	cout << "  --masks=[shape]         dense, sparse, mixed or ranges (default: mixed)" << endl;
+	cout << "  --seed=[N]              Seed of the generator (default: 1)" << endl;
+	cout << "  --reps=[N]              Runs of each configuration, the best counts (default: 3)" << endl;
+	cout << "  -j[N]                   Threads used by mcasm (default: number of cores)" << endl;
+	cout << "  --suite                 Run the standard set of configurations" << endl;
+	cout << "  --dump=[dir]            Only write the source files to dir" << endl;
+	cout << "  --out=[file]            Write the results as JSON to file (default: stdout)" << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+	genparams_t gp = {16, 1000, 2, 20, 4, "mixed", 1};
+	int nreps = 3;
+	int nthreads = 0;
+	bool bsuite = false;
+	string dump_dir;
+	string out_file;
+
+	for (int ac = 1; ac < argc; ac++) {
+		const char *a = argv[ac];
+		if (0 == strncmp(a, "--bits=", 7))
+			gp.nbits = atoi(a + 7);
+		else if (0 == strncmp(a, "--ops=", 6))
+			gp.nops = atoi(a + 6);
+		else if (0 == strncmp(a, "--chips=", 8))
+			gp.nchips = atoi(a + 8);
+		else if (0 == strncmp(a, "--macros=", 9))
+			gp.nmacros = atoi(a + 9);
+		else if (0 == strncmp(a, "--includes=", 11))
+			gp.nincludes = atoi(a + 11);
+		else if (0 == strncmp(a, "--masks=", 8))
+			gp.smasks = a + 8;
+		else if (0 == strncmp(a, "--seed=", 7))
+			gp.nseed = strtoul(a + 7, NULL, 10);
+		else if (0 == strncmp(a, "--reps=", 7))
+			nreps = max(1, atoi(a + 7));
+		else if (0 == strncmp(a, "-j", 2))
+			nthreads = atoi(a + 2);
+		else if (0 == strcmp(a, "--suite"))
+			bsuite = true;
+		else if (0 == strncmp(a, "--dump=", 7))
+			dump_dir = a + 7;
+		else if (0 == strncmp(a, "--out=", 6))
+			out_file = a + 6;
+		else {
+			print_help();
+			return ((0 == strcmp(a, "-h")) || (0 == strcmp(a, "--help"))) ? 0 : -1;
+		}
+	}
+	if ((gp.nbits < 8) || (gp.nbits > 28) || (gp.nops < 1) || (gp.nchips < 1) || (gp.nincludes < 0) ||
+			((gp.smasks != "dense") && (gp.smasks != "sparse") && (gp.smasks != "mixed") && (gp.smasks != "ranges"))) {
+		cerr << "ERROR: Invalid parameters" << endl;
+		return -1;
+	}
+
+	// just the source (to run mcasm on it)
+	if (!dump_dir.empty()) {
+		map<string, string> mfiles;
+		generate(gp, mfiles);
+		for (auto& f : mfiles) {
+			ofstream ofs(dump_dir + "/" + f.first, ios::binary);
+			ofs << f.second;
+			if (!ofs) {
+				cerr << "ERROR: Can't write " << dump_dir << "/" << f.first << endl;
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	// the standard set: bits, ops, chips, macros, includes, masks
+	vector<genparams_t> vconfigs;
+	if (bsuite) {
+		vconfigs = {
+			{12,    100, 1,  0,  0, "dense",  1},
+			{16,   1000, 2, 20,  4, "mixed",  1},
+			{16,  10000, 3, 50,  8, "sparse", 1},
+			{20,  10000, 2, 20,  4, "ranges", 1},
+			{20, 100000, 4, 20, 16, "mixed",  1},
+			{24,  10000, 2,  0,  4, "dense",  1},
+		};
+	} else {
+		vconfigs.push_back(gp);
+	}
+
+	ostringstream json;
+	json << "{\"version\":\"" << VERSION_MAJOR << "." << VERSION_MINOR
+#ifdef VERSION_EXTRA
+	     << "-" << VERSION_EXTRA
+#endif
+	     << "\",\"results\":[";
+	for (size_t n = 0; n < vconfigs.size(); ++n) {
+		if (n)
+			json << ",";
+		json << "\n";
+		if (run(vconfigs[n], nreps, nthreads, json) == -1)
+			return -1;
+	}
+	json << "\n]}\n";
+
+	if (out_file.empty()) {
+		cout << json.str();
+		return 0;
+	}
+	ofstream ofs(out_file);
+	ofs << json.str();
+	if (!ofs) {
+		cerr << "ERROR: Can't write " << out_file << endl;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,762 @@
+/*
+ *
+ *    difftest.cpp - this file is part of Microcode Compiler/Assembler
+ *
+ *    Copyright (C) 2017-2022 Lennart Molnar <pernicius@web.de>
+ *
+ *    This program is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "mcasm.h"
+
+using namespace std;
+
+
+/*
+ * mcdifftest - checks every engine and output format against the reference
+ *
+ *  first a fixed list of constant expressions at the edges of long long, then
+ *  random sources (overlapping cubes, ranges, sets, constants, several chips)
+ *  are compiled with the naive loop (--reference) and with everything else,
+ *  the first case that differs is shrunk to a minimal .mc file
+ *
+ *  the reference itself works on the cubes the sets and ranges are split into,
+ *  so the op winning each address is also checked against the op fields read
+ *  directly (value by value, no cubes)
+ */
+
+
+typedef struct rinput {
+	string sname;
+	int nbits;
+} rinput_t;
+
+
+typedef struct rsignal {
+	string sname;
+	int nchip, nstart, nbits;
+	int ndefault;       // -1 = not in #defaults
+} rsignal_t;
+
+
+typedef struct rop {
+	vector<string> vsfields;    // one for each input ('*' ends the list)
+	vector<string> vsbody;      // signal assignments
+} rop_t;
+
+
+// a random source, kept structured so it can be shrunk
+typedef struct rsource {
+	vector<rinput_t> vinputs;
+	vector<rsignal_t> vsignals;
+	vector<pair<string, int> > vconsts;     // #define name (value)
+	vector<rop_t> vops;
+} rsource_t;
+
+
+// deterministic on all platforms (the distributions of <random> are not)
+class Rand
+{
+	mt19937 gen;
+
+public:
+	Rand(unsigned nseed) : gen(nseed) {}
+	int Next(int n) { return (int)(gen() % (unsigned)n); }
+	bool Chance(int nper) { return Next(100) < nper; }
+};
+
+
+string to_text(const rsource_t& src) {
+	ostringstream os;
+	int nbit = 0;
+
+	os << "#inputs {\n";
+	for (auto& i : src.vinputs) {
+		os << " " << nbit << ".." << nbit + i.nbits - 1 << " = " << i.sname << "\n";
+		nbit += i.nbits;
+	}
+	os << "}\n#signals {\n";
+	for (auto& s : src.vsignals)
+		os << " " << s.nchip << ":" << s.nstart << ".." << s.nstart + s.nbits - 1 << " = " << s.sname << "\n";
+	os << "}\n#defaults {\n";
+	for (auto& s : src.vsignals) {
+		if (s.ndefault >= 0)
+			os << " " << s.sname << " = " << s.ndefault << "\n";
+	}
+	os << "}\n";
+	for (auto& c : src.vconsts)
+		os << "#define " << c.first << " (" << c.second << ")\n";
+	for (size_t n = 0; n < src.vops.size(); ++n) {
+		const rop_t& op = src.vops[n];
+		os << "#op(";
+		for (size_t f = 0; f < op.vsfields.size(); ++f)
+			os << (f ? ", " : "") << op.vsfields[f];
+		os << ") { op" << n << "\n";
+		for (auto& b : op.vsbody)
+			os << " " << b << "\n";
+		os << "}\n";
+	}
+	return os.str();
+}
+
+
+// value of one input of an op
+string random_field(Rand& rnd, const rsource_t& src, int nbits) {
+	int nmax = 1 << nbits;
+	int a = rnd.Next(nmax), b = rnd.Next(nmax);
+	int k = rnd.Next(100);
+
+	if (a > b)
+		swap(a, b);
+	if (k < 30)
+		return "x";
+	if (k < 45)
+		return to_string(a) + ".." + to_string(b);
+	if (k < 55)
+		return "{" + to_string(rnd.Next(nmax)) + ", " + to_string(a) + ".." + to_string(b) + "}";
+	if ((k < 65) && !src.vconsts.empty()) {
+		const pair<string, int>& c = src.vconsts[rnd.Next(src.vconsts.size())];
+		if (c.second < nmax)
+			return c.first;
+	}
+	return to_string(a);
+}
+
+
+rsource_t random_source(Rand& rnd, int nmaxops) {
+	rsource_t src;
+	int nbits = 0;
+	int naddrbits = 2 + rnd.Next(12);
+
+	// inputs
+	while (nbits < naddrbits) {
+		rinput_t in = {"i" + to_string(src.vinputs.size()), min(naddrbits - nbits, 1 + rnd.Next(5))};
+		nbits += in.nbits;
+		src.vinputs.push_back(in);
+	}
+
+	// signals on up to 3 chips, packed from bit 0 (with some gaps)
+	int nchips = 1 + rnd.Next(3);
+	for (int c = 0; c < nchips; ++c) {
+		int nstart = 0;
+		for (int n = 1 + rnd.Next(5); n > 0; --n) {
+			rsignal_t sig;
+			sig.sname = "s" + to_string(src.vsignals.size());
+			sig.nchip = c;
+			sig.nstart = nstart + (rnd.Chance(20) ? 1 : 0);
+			sig.nbits = 1 + rnd.Next(6);
+			sig.ndefault = rnd.Chance(50) ? rnd.Next(1 << sig.nbits) : -1;
+			if (sig.nstart + sig.nbits > 24)
+				break;
+			nstart = sig.nstart + sig.nbits;
+			src.vsignals.push_back(sig);
+		}
+	}
+
+	// constants
+	for (int n = rnd.Next(4); n > 0; --n)
+		src.vconsts.push_back(make_pair("C" + to_string(src.vconsts.size()), rnd.Next(32)));
+
+	// ops (sometimes enough of them for the parallel parser)
+	int nops = rnd.Chance(10) ? 513 + rnd.Next(600) : 1 + rnd.Next(40);
+	nops = min(nops, nmaxops);
+	for (int n = 0; n < nops; ++n) {
+		rop_t op;
+		for (auto& in : src.vinputs) {
+			if (!op.vsfields.empty() && rnd.Chance(5)) {
+				op.vsfields.push_back("*");
+				break;
+			}
+			op.vsfields.push_back(random_field(rnd, src, in.nbits));
+		}
+		for (int b = rnd.Next(4); b > 0; --b) {
+			const rsignal_t& sig = src.vsignals[rnd.Next(src.vsignals.size())];
+			switch (rnd.Next(3)) {
+			case 0:
+				op.vsbody.push_back(sig.sname);
+				break;
+			case 1:
+				op.vsbody.push_back("!" + sig.sname);
+				break;
+			default:
+				op.vsbody.push_back(sig.sname + " = " + to_string(rnd.Next(1 << sig.nbits)));
+				break;
+			}
+		}
+		src.vops.push_back(op);
+	}
+	return src;
+}
+
+
+// an older revision of a source: a few ops deleted, moved or changed, a constant changed
+rsource_t mutate(rsource_t src, Rand& rnd) {
+	for (int n = 1 + rnd.Next(3); (n > 0) && !src.vops.empty(); --n) {
+		int nops = (int)src.vops.size();
+		int a = rnd.Next(nops), b = rnd.Next(nops);
+		switch (rnd.Next(5)) {
+		case 0:
+			if (nops > 1)
+				src.vops.erase(src.vops.begin() + a);
+			break;
+		case 1:
+			swap(src.vops[a], src.vops[b]);
+			break;
+		case 2:
+			src.vops[a].vsbody = src.vops[b].vsbody;
+			break;
+		case 3: {
+			size_t f = rnd.Next(src.vops[a].vsfields.size());
+			if (src.vops[a].vsfields[f] != "*")
+				src.vops[a].vsfields[f] = random_field(rnd, src, src.vinputs[f].nbits);
+			break;
+		}
+		default:
+			if (!src.vconsts.empty())
+				src.vconsts[rnd.Next(src.vconsts.size())].second = rnd.Next(32);
+			break;
+		}
+	}
+	return src;
+}
+
+
+// does the value of an input match the field of an op (read directly, no cubes)
+bool field_matches(const rsource_t& src, const string& sfield, int nval) {
+	if (sfield == "x")
+		return true;
+	if (sfield[0] == '{') {
+		int v, a, b;
+		sscanf(sfield.c_str(), "{%d, %d..%d}", &v, &a, &b);
+		return (nval == v) || ((nval >= a) && (nval <= b));
+	}
+	size_t p = sfield.find("..");
+	if (p != string::npos)
+		return (nval >= atoi(sfield.c_str())) && (nval <= atoi(sfield.c_str() + p + 2));
+	for (auto& c : src.vconsts) {
+		if (c.first == sfield)
+			return nval == c.second;
+	}
+	return nval == atoi(sfield.c_str());
+}
+
+
+bool op_matches(const rsource_t& src, const rop_t& op, int naddr) {
+	int nbit = 0;
+	for (size_t f = 0; f < op.vsfields.size(); ++f) {
+		if (op.vsfields[f] == "*")
+			break;
+		int nbits = src.vinputs[f].nbits;
+		if (!field_matches(src, op.vsfields[f], (naddr >> nbit) & ((1 << nbits) - 1)))
+			return false;
+		nbit += nbits;
+	}
+	return true;
+}
+
+
+// the first op matching an address (-1 = none), the naive way
+int naive_op(const rsource_t& src, int naddr) {
+	for (size_t n = 0; n < src.vops.size(); ++n) {
+		if (op_matches(src, src.vops[n], naddr))
+			return (int)n;
+	}
+	return -1;
+}
+
+
+// words of a Logisim or binary file (empty if it can't be read)
+vector<int> read_words(const string& sfile, int nwords, int nwordbits, bool blogisim) {
+	vector<int> v;
+	ifstream ifs(sfile, ios::binary);
+	if (!ifs)
+		return v;
+	if (blogisim) {
+		string sline;
+		getline(ifs, sline);
+		while (getline(ifs, sline)) {
+			if (!sline.empty() && (sline[0] != '#'))
+				v.push_back((int)strtoul(sline.c_str(), NULL, 16));
+		}
+		return v;
+	}
+	int nbytes = (nwordbits + 7) / 8;
+	vector<char> vbuf((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+	for (int a = 0; (a < nwords) && ((size_t)(a + 1) * nbytes <= vbuf.size()); ++a) {
+		int w = 0;
+		for (int b = 0; b < nbytes; ++b)
+			w |= (unsigned char)vbuf[(size_t)a * nbytes + b] << (b * 8);
+		v.push_back(w);
+	}
+	return v;
+}
+
+
+// all engines against the reference, returns the name of the first one that differs ("" = ok)
+//  sdir gets the temporary files
+string check(const rsource_t& src, const string& sdir, int nthreads, unsigned nseed) {
+	Rand rnd(nseed);
+	string stext = to_text(src);
+	ostringstream log;
+	image_t ref;
+	string sfile = sdir + "/mcdifftest_%d.tmp";
+
+	auto setup = [&](Mcasm& mc) {
+		mc.SetOutput(&log, &log);
+		mc.Config().s = true;
+		mc.Config().nthreads = nthreads;
+		mc.SetFile("t.mc", stext);
+	};
+
+	// the reference (the source may just be invalid, nothing to compare then)
+	{
+		Mcasm mc;
+		setup(mc);
+		mc.Config().nthreads = 1;
+		mc.SetReference(true);
+		if (mc.Compile("t.mc", ref) == -1)
+			return "";
+	}
+	const int nwords = ref.nwords;
+	auto row = [&](const image_t& img, int x) {
+		return vector<int>(img.vnwords.begin() + (size_t)x * img.nwords, img.vnwords.begin() + (size_t)(x + 1) * img.nwords);
+	};
+
+	// matcher (and the parallel parser)
+	{
+		Mcasm mc;
+		image_t img;
+		setup(mc);
+		if ((mc.Compile("t.mc", img) == -1) || (img.vnwords != ref.vnwords))
+			return "matcher";
+	}
+	// single addresses
+	{
+		Mcasm mc;
+		setup(mc);
+		if (mc.Open("t.mc") == -1)
+			return "lookup";
+		for (int a = 0; a < nwords; ++a) {
+			lookup_t res;
+			if (mc.Lookup(a, res) == -1)
+				return "lookup";
+			for (int x = 0; x < ref.nchips; ++x) {
+				if (res.vnwords[x] != ref.vnwords[(size_t)x * nwords + a])
+					return "lookup";
+			}
+		}
+	}
+	// each chip on its own
+	for (int x = 0; x < ref.nchips; ++x) {
+		Mcasm mc;
+		image_t img;
+		setup(mc);
+		mc.SelectChips(vector<int>(1, x));
+		if ((mc.Compile("t.mc", img) == -1) || (row(img, x) != row(ref, x)))
+			return "chip";
+	}
+	// output formats, read back (and checked by --verify)
+	for (const char *sformat : {"logisim", "bin"}) {
+		Mcasm mc;
+		setup(mc);
+		if (mc.Write(ref, sfile, sformat) == -1)
+			return sformat;
+		for (int x = 0; x < ref.nchips; ++x) {
+			char buf[512];
+			snprintf(buf, sizeof(buf), sfile.c_str(), x);
+			if (read_words(buf, nwords, ref.nwordbits, sformat[0] == 'l') != row(ref, x))
+				return sformat;
+		}
+		if ((mc.Open("t.mc") == -1) || (mc.Verify(sfile, 0) != 0))
+			return string("verify ") + sformat;
+	}
+	// shards at random split points, merged again
+	{
+		int nsplit = rnd.Next(nwords);
+		vector<string> vsshards;
+		for (int s = 0; s < 2; ++s) {
+			Mcasm mc;
+			image_t img;
+			setup(mc);
+			if ((s == 0) && (nsplit == 0))
+				continue;
+			mc.SetRange(s ? nsplit : 0, s ? nwords - 1 : nsplit - 1);
+			string spattern = sdir + "/mcdifftest_shard" + to_string(s) + "_%d.tmp";
+			if ((mc.Compile("t.mc", img) == -1) || (mc.Write(img, spattern, "shard") == -1))
+				return "shard";
+			for (int x = 0; x < ref.nchips; ++x) {
+				char buf[512];
+				snprintf(buf, sizeof(buf), spattern.c_str(), x);
+				vsshards.push_back(buf);
+			}
+		}
+		Mcasm mc;
+		image_t img;
+		setup(mc);
+		if ((mc.Merge(vsshards, img) == -1) || (img.vnwords != ref.vnwords))
+			return "merge";
+	}
+	// variant with another value of a constant (reuses the unchanged ops)
+	for (auto& d : ref.vdefs) {
+		long long nval = rnd.Next(32);
+		image_t vref;
+		{
+			Mcasm mc;
+			setup(mc);
+			mc.Config().nthreads = 1;
+			mc.SetReference(true);
+			mc.Define(d.sname, nval);
+			if (mc.Compile("t.mc", vref) == -1)
+				break;      // the value doesn't fit an input
+		}
+		Mcasm mc;
+		vector<variant_t> vvars(1);
+		setup(mc);
+		vvars[0].sname = "v";
+		vvars[0].moverrides[d.sname] = nval;
+		if ((mc.CompileVariants("t.mc", vvars) != 0) || (vvars[0].image.vnwords != vref.vnwords))
+			return "variant";
+		break;
+	}
+	// the ops winning (and matching) each address, read from the op fields
+	//  (single addresses and the coverage computed on the cubes)
+	{
+		vector<int> vnowned(src.vops.size(), 0), vnmatched(src.vops.size(), 0);
+		int nuncovered = 0;
+		Mcasm mc;
+		setup(mc);
+		if (mc.Open("t.mc") == -1)
+			return "cubes";
+		for (int a = 0; a < nwords; ++a) {
+			lookup_t res;
+			int nop = naive_op(src, a);
+			if ((mc.Lookup(a, res) == -1) || (res.sop != ((nop >= 0) ? "op" + to_string(nop) : "")))
+				return "cubes";
+			if (nop >= 0)
+				++vnowned[nop];
+			else
+				++nuncovered;
+			for (size_t n = 0; n < src.vops.size(); ++n)
+				vnmatched[n] += op_matches(src, src.vops[n], a);
+		}
+		ostringstream sexpect;
+		for (size_t n = 0; n < src.vops.size(); ++n)
+			sexpect << "op" << n << ": " << vnowned[n] << " of " << vnmatched[n] << " address(es)\n";
+		sexpect << "Defaults: " << nuncovered << " address(es)";
+		log.str("");
+		if (mc.Coverage() == -1)
+			return "coverage";
+		// (without the shadowing ops and the cubes left to the defaults)
+		istringstream is(log.str());
+		string sline, sgot;
+		while (getline(is, sline)) {
+			if ((0 == sline.compare(0, 2, "op")) || (0 == sline.compare(0, 9, "Defaults:")))
+				sgot += sline.substr(0, sline.find(" address(es)") + 12) + "\n";
+		}
+		if (sgot != sexpect.str() + "\n")
+			return "coverage";
+	}
+	// each chip generated on its own in two shards, all merged again
+	{
+		vector<string> vsshards;
+		for (int x = 0; x < ref.nchips; ++x) {
+			int nsplit = rnd.Next(nwords);
+			for (int s = 0; s < 2; ++s) {
+				Mcasm mc;
+				image_t img;
+				setup(mc);
+				if ((s == 0) && (nsplit == 0))
+					continue;
+				mc.SelectChips(vector<int>(1, x));
+				mc.SetRange(s ? nsplit : 0, s ? nwords - 1 : nsplit - 1);
+				string spattern = sdir + "/mcdifftest_chip" + to_string(s) + "_%d.tmp";
+				if ((mc.Compile("t.mc", img) == -1) || (mc.Write(img, spattern, "shard") == -1))
+					return "chip shard";
+				char buf[512];
+				snprintf(buf, sizeof(buf), spattern.c_str(), x);
+				vsshards.push_back(buf);
+			}
+		}
+		Mcasm mc;
+		image_t img;
+		setup(mc);
+		if ((mc.Merge(vsshards, img) == -1) || (img.vnwords != ref.vnwords))
+			return "chip merge";
+	}
+	// an older revision of the source (not checked if it's invalid)
+	string sold = to_text(mutate(src, rnd));
+	image_t oref;
+	{
+		Mcasm mc;
+		setup(mc);
+		mc.SetFile("t.mc", sold);
+		mc.Config().nthreads = 1;
+		mc.SetReference(true);
+		if (mc.Compile("t.mc", oref) == -1)
+			return "";
+	}
+	// watch mode: the older revision first, then the source as a change of it
+	{
+		Mcasm mc;
+		string spattern = sdir + "/mcdifftest_watch_%d.tmp";
+		setup(mc);
+		mc.SetFile("t.mc", sold);
+		if (mc.Update("t.mc", vector<string>(), spattern, "logisim") == -1)
+			return "watch";
+		mc.SetFile("t.mc", stext);
+		if (mc.Update("t.mc", vector<string>(1, "t.mc"), spattern, "logisim") == -1)
+			return "watch";
+		for (int x = 0; x < ref.nchips; ++x) {
+			char buf[512];
+			snprintf(buf, sizeof(buf), spattern.c_str(), x);
+			if (read_words(buf, nwords, ref.nwordbits, true) != row(ref, x))
+				return "watch";
+		}
+	}
+	// diff from the older revision: its words with the patch applied
+	{
+		Mcasm mo, mc;
+		string spatch = sdir + "/mcdifftest_patch.tmp";
+		setup(mo);
+		setup(mc);
+		mo.SetFile("t.mc", sold);
+		if ((mo.Open("t.mc") == -1) || (mc.Open("t.mc") == -1))
+			return "diff";
+		long long nchanged = mc.Diff(mo, spatch);
+		long long nexpect = 0;
+		for (int a = 0; a < nwords; ++a) {
+			for (int x = 0; x < ref.nchips; ++x) {
+				if (oref.vnwords[(size_t)x * nwords + a] != ref.vnwords[(size_t)x * nwords + a]) {
+					++nexpect;
+					break;
+				}
+			}
+		}
+		if (nchanged != nexpect)
+			return "diff";
+		ifstream ifs(spatch);
+		string sline;
+		while (getline(ifs, sline)) {
+			if (sline.empty() || (sline[0] == '#'))
+				continue;
+			istringstream is(sline);
+			int a, w;
+			is >> hex >> a;
+			for (int x = 0; (x < oref.nchips) && (is >> w); ++x)
+				oref.vnwords[(size_t)x * nwords + a] = w;
+		}
+		if (oref.vnwords != ref.vnwords)
+			return "diff";
+	}
+	return "";
+}
+
+
+// removes parts of the source as long as the same engine still fails
+rsource_t shrink(rsource_t src, const string& sengine, const string& sdir, int nthreads, unsigned nseed) {
+	auto fails = [&](const rsource_t& s) {
+		return check(s, sdir, nthreads, nseed) == sengine;
+	};
+	bool bchanged = true;
+
+	while (bchanged) {
+		bchanged = false;
+		// whole ops
+		for (size_t n = src.vops.size(); n-- > 0; ) {
+			rsource_t t = src;
+			t.vops.erase(t.vops.begin() + n);
+			if (fails(t)) {
+				src = t;
+				bchanged = true;
+			}
+		}
+		// signal assignments, then inputs of the ops
+		for (size_t n = 0; n < src.vops.size(); ++n) {
+			for (size_t b = src.vops[n].vsbody.size(); b-- > 0; ) {
+				rsource_t t = src;
+				t.vops[n].vsbody.erase(t.vops[n].vsbody.begin() + b);
+				if (fails(t)) {
+					src = t;
+					bchanged = true;
+				}
+			}
+			for (size_t f = 0; f < src.vops[n].vsfields.size(); ++f) {
+				if ((src.vops[n].vsfields[f] == "x") || (src.vops[n].vsfields[f] == "*"))
+					continue;
+				rsource_t t = src;
+				t.vops[n].vsfields[f] = "x";
+				if (fails(t)) {
+					src = t;
+					bchanged = true;
+				}
+			}
+		}
+		// defaults, unused signals and constants
+		for (size_t n = 0; n < src.vsignals.size(); ++n) {
+			if (src.vsignals[n].ndefault < 0)
+				continue;
+			rsource_t t = src;
+			t.vsignals[n].ndefault = -1;
+			if (fails(t)) {
+				src = t;
+				bchanged = true;
+			}
+		}
+		for (size_t n = src.vsignals.size(); (n-- > 0) && (src.vsignals.size() > 1); ) {
+			rsource_t t = src;
+			t.vsignals.erase(t.vsignals.begin() + n);
+			if (fails(t)) {
+				src = t;
+				bchanged = true;
+			}
+		}
+		for (size_t n = src.vconsts.size(); n-- > 0; ) {
+			rsource_t t = src;
+			t.vconsts.erase(t.vconsts.begin() + n);
+			if (fails(t)) {
+				src = t;
+				bchanged = true;
+			}
+		}
+	}
+	return src;
+}
+
+
+// constant expressions at the edges of long long: the value or an error (never a crash)
+typedef struct exprcase {
+	const char *sexpr;
+	long long nval;
+	const char *serror;     // part of the expected error (NULL = valid)
+} exprcase_t;
+
+
+static const exprcase_t exprcases[] = {
+	{ "7 / -2", -3, NULL },
+	{ "-7 % 2", -1, NULL },
+	{ "-9223372036854775807 - 1", -9223372036854775807LL - 1, NULL },
+	{ "(-9223372036854775807 - 1) / 1", -9223372036854775807LL - 1, NULL },
+	{ "(-9223372036854775807 - 1) / -1", 0, "Overflow" },
+	{ "(-9223372036854775807 - 1) % -1", 0, "Overflow" },
+	{ "9223372036854775807 + 1", 0, "Overflow" },
+	{ "-9223372036854775807 - 2", 0, "Overflow" },
+	{ "-(-9223372036854775807 - 1)", 0, "Overflow" },
+	{ "3037000500 * 3037000500", 0, "Overflow" },
+	{ "-1 * (-9223372036854775807 - 1)", 0, "Overflow" },
+	{ "1 << 63", -9223372036854775807LL - 1, NULL },
+	{ "1 / 0", 0, "Division by zero" },
+	{ "1 % 0", 0, "Division by zero" },
+};
+
+
+// all expression cases, returns the number of failed ones
+int check_expressions() {
+	int nfailed = 0;
+
+	for (auto& c : exprcases) {
+		ostringstream log;
+		image_t img;
+		Mcasm mc;
+		mc.SetOutput(&log, &log);
+		mc.Config().s = true;
+		mc.SetFile("t.mc", string("#inputs {\n 0 = a\n}\n#signals {\n 0:0 = s\n}\n#define V (") + c.sexpr + ")\n");
+		int ret = mc.Compile("t.mc", img);
+		bool bok;
+		if (c.serror)
+			bok = (ret == -1) && (log.str().find(c.serror) != string::npos);
+		else
+			bok = (ret == 1) && (img.vdefs.size() == 1) && (img.vdefs[0].nval == c.nval);
+		if (!bok) {
+			cerr << "FAILED: expression " << c.sexpr << ": expected " << (c.serror ? c.serror : to_string(c.nval))
+			     << ", got: " << ((ret == 1) && !img.vdefs.empty() ? to_string(img.vdefs[0].nval) : log.str()) << endl;
+			++nfailed;
+		}
+	}
+	return nfailed;
+}
+
+
+void print_help() {
+	cout << "Usage: mcdifftest [options]" << endl;
+	cout << "Compiles random sources with the reference (naive loop) and all other engines" << endl;
+	cout << "and output formats, the first difference is shrunk to a minimal source" << endl;
+	cout << "Options:" << endl;
+	cout << "  --cases=[N]             Number of random sources (default: 200)" << endl;
+	cout << "  --seed=[N]              Seed of the first case (default: 1)" << endl;
+	cout << "  --max-ops=[N]           Max. number of ops of a source (default: 1200)" << endl;
+	cout << "  -j[N]                   Threads used by mcasm (default: 4)" << endl;
+	cout << "  --dir=[dir]             Temporary files and the reproducer (default: .)" << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+	int ncases = 200;
+	unsigned nseed = 1;
+	int nmaxops = 1200;
+	int nthreads = 4;
+	string sdir = ".";
+
+	for (int ac = 1; ac < argc; ac++) {
+		const char *a = argv[ac];
+		if (0 == strncmp(a, "--cases=", 8))
+			ncases = atoi(a + 8);
+		else if (0 == strncmp(a, "--seed=", 7))
+			nseed = strtoul(a + 7, NULL, 10);
+		else if (0 == strncmp(a, "--max-ops=", 10))
+			nmaxops = max(1, atoi(a + 10));
+		else if (0 == strncmp(a, "-j", 2))
+			nthreads = max(1, atoi(a + 2));
+		else if (0 == strncmp(a, "--dir=", 6))
+			sdir = a + 6;
+		else {
+			print_help();
+			return ((0 == strcmp(a, "-h")) || (0 == strcmp(a, "--help"))) ? 0 : -1;
+		}
+	}
+
+	if (check_expressions() > 0)
+		return -1;
+	for (int n = 0; n < ncases; ++n) {
+		unsigned s = nseed + n;
+		Rand rnd(s);
+		rsource_t src = random_source(rnd, nmaxops);
+		string sengine = check(src, sdir, nthreads, s);
+		if (sengine.empty())
+			continue;
+
+		// minimal reproducer
+		cerr << "FAILED: seed " << s << ": " << sengine << " differs from the reference, shrinking..." << endl;
+		src = shrink(src, sengine, sdir, nthreads, s);
+		string sfile = sdir + "/mcdifftest_fail_" + to_string(s) + ".mc";
+		ofstream ofs(sfile);
+		ofs << "// mcdifftest seed " << s << ": " << sengine << " differs from --reference\n" << to_text(src);
+		cerr << "Reproducer (" << src.vops.size() << " op(s)): " << sfile << endl;
+		return -1;
+	}
+	cout << ncases << " case(s) ok" << endl;
+	return 0;
+}